@@ -95,6 +95,8 @@ int main(int argc, const char * argv[])
 	uint32_t maxThreads = GetNumHardwareThreads();
 	double* times = new double[ maxThreads ];
 	double* stdev = new double[ maxThreads ];
+	uint64_t* stealAttempts = new uint64_t[ maxThreads ];
+	double* stealRate = new double[ maxThreads ];
 
 	for( uint32_t numThreads = 1; numThreads <= maxThreads; ++numThreads )
 	{
@@ -105,6 +107,10 @@ int main(int argc, const char * argv[])
 		uint32_t totalErrors = 0;
 		for( int run = 0; run< REPEATS; ++run )
 		{
+			if( run == WARMUPS )
+			{
+				g_TS.ResetStats();
+			}
 
 			printf("Run %d.....\n", run);
 			Timer tParallel;
@@ -147,17 +153,27 @@ int main(int argc, const char * argv[])
 
 		printf("\nAverage Time for %d Hardware Threads: %fms, rate: %f M tasks/s. %d errors found.\n", numThreads, avTime, numTasks / avTime / 1000.0f, totalErrors );
 
+		TaskSchedulerStats stats = g_TS.GetStats();
+		stealAttempts[numThreads-1] = stats.numStealAttempts;
+		stealRate[numThreads-1] = stats.numStealAttempts ? (double)stats.numSteals / (double)stats.numStealAttempts : 0.0;
+		printf("Steals: %" PRIu64 " of %" PRIu64 " attempts succeeded, %" PRIu64 " partitions run.\n",
+			stats.numSteals, stats.numStealAttempts, stats.numPartitionsRun );
+
 		times[numThreads-1] = avTime;
 		stdev[numThreads-1] = sqrt(RUNS * avTime2 - (RUNS * avTime)*(RUNS * avTime)) / RUNS;
 	}
 
-	printf("\nHardware Threads, Time, std, MTasks/s, Perf Multiplier\n" );
+	printf("\nHardware Threads, Time, std, MTasks/s, Perf Multiplier, Steal Attempts, Steal Success Rate\n" );
 	for( uint32_t numThreads = 1; numThreads <= maxThreads; ++numThreads )
 	{
-		printf("%d, %f, %f, %f, %f\n", numThreads, times[numThreads-1], stdev[numThreads-1], numTasks / times[numThreads-1] / 1000.0f, times[0] / times[numThreads-1] );
+		printf("%d, %f, %f, %f, %f, %" PRIu64 ", %f\n", numThreads, times[numThreads-1], stdev[numThreads-1], numTasks / times[numThreads-1] / 1000.0f, times[0] / times[numThreads-1],
+			stealAttempts[numThreads-1], stealRate[numThreads-1] );
 	}
 
 	delete[] times;
+	delete[] stdev;
+	delete[] stealAttempts;
+	delete[] stealRate;
 
 	return 0;
 }
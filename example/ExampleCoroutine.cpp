@@ -0,0 +1,132 @@
+// Copyright (c) 2013 Doug Binks
+// 
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any damages
+// arising from the use of this software.
+// 
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+// 
+// 1. The origin of this software must not be misrepresented; you must not
+//    claim that you wrote the original software. If you use this software
+//    in a product, an acknowledgement in the product documentation would be
+//    appreciated but is not required.
+// 2. Altered source versions must be plainly marked as such, and must not be
+//    misrepresented as being the original software.
+// 3. This notice may not be removed or altered from any source distribution.
+
+#include "TaskScheduler.h"
+#include "TaskSchedulerCoroutine.h"
+#include "Timer.h"
+
+#include <stdio.h>
+#include <inttypes.h>
+#include <vector>
+
+using namespace enki;
+
+
+// Multi-stage jobs as coroutines - requires C++ 20.
+// Each job sums a range in parallel, then scales it in parallel using the sum. Between stages
+// the job is suspended, so no thread waits for it, and it continues on the thread which
+// completed the previous stage.
+
+TaskScheduler g_TS;
+
+static const uint32_t NUM_JOBS = 8;
+static const uint32_t JOB_SIZE = 1024 * 1024;
+
+struct SumTaskSet : ITaskSet
+{
+	const float*      m_pValues;
+	volatile int32_t  m_Sum;
+
+	SumTaskSet() : m_pValues(NULL), m_Sum(0) { m_SetSize = JOB_SIZE; m_MinRange = 4096; }
+
+	virtual void    ExecuteRange( TaskSetPartition range, uint32_t threadnum )
+	{
+		int32_t sum = 0;
+		for( uint32_t i = range.start; i < range.end; ++i )
+		{
+			sum += (int32_t)m_pValues[i];
+		}
+		AtomicAdd( &m_Sum, sum );
+	}
+};
+
+struct ScaleTaskSet : ITaskSet
+{
+	float*            m_pValues;
+	float             m_Scale;
+
+	ScaleTaskSet() : m_pValues(NULL), m_Scale(1.0f) { m_SetSize = JOB_SIZE; m_MinRange = 4096; }
+
+	virtual void    ExecuteRange( TaskSetPartition range, uint32_t threadnum )
+	{
+		for( uint32_t i = range.start; i < range.end; ++i )
+		{
+			m_pValues[i] *= m_Scale;
+		}
+	}
+};
+
+struct Job
+{
+	float           values[ JOB_SIZE ];
+	SumTaskSet      sumTask;
+	ScaleTaskSet    scaleTask;
+};
+
+Coroutine RunJob( Job* pJob_ )
+{
+	pJob_->sumTask.m_pValues = pJob_->values;
+	co_await AddTaskSetAndAwait( g_TS, &pJob_->sumTask );
+
+	pJob_->scaleTask.m_pValues = pJob_->values;
+	pJob_->scaleTask.m_Scale   = 1.0f / (float)pJob_->sumTask.m_Sum;
+	co_await AddTaskSetAndAwait( g_TS, &pJob_->scaleTask );
+}
+
+int main(int argc, const char * argv[])
+{
+	g_TS.Initialize();
+
+	Job* pJobs = new Job[ NUM_JOBS ];
+	for( uint32_t job = 0; job < NUM_JOBS; ++job )
+	{
+		for( uint32_t i = 0; i < JOB_SIZE; ++i )
+		{
+			pJobs[ job ].values[i] = (float)( ( i + job ) % 4 );
+		}
+	}
+
+	Timer tJobs;
+	tJobs.Start();
+	std::vector<Coroutine> coroutines;
+	coroutines.reserve( NUM_JOBS );
+	for( uint32_t job = 0; job < NUM_JOBS; ++job )
+	{
+		// runs until the first co_await, then returns
+		coroutines.push_back( RunJob( &pJobs[ job ] ) );
+	}
+	for( uint32_t job = 0; job < NUM_JOBS; ++job )
+	{
+		WaitforCoroutine( g_TS, coroutines[ job ] );
+	}
+	tJobs.Stop();
+
+	uint32_t numErrors = 0;
+	for( uint32_t job = 0; job < NUM_JOBS; ++job )
+	{
+		float expected = 1.0f / (float)pJobs[ job ].sumTask.m_Sum;
+		for( uint32_t i = 0; i < JOB_SIZE; ++i )
+		{
+			if( pJobs[ job ].values[i] != (float)( ( i + job ) % 4 ) * expected ) { ++numErrors; }
+		}
+	}
+	printf("%d coroutine jobs of 2 stages in %fms, %d errors\n", NUM_JOBS, tJobs.GetTimeMS(), numErrors );
+
+	delete[] pJobs;
+	return 0;
+}
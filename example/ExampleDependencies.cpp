@@ -0,0 +1,162 @@
+// Copyright (c) 2013 Doug Binks
+// 
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any damages
+// arising from the use of this software.
+// 
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+// 
+// 1. The origin of this software must not be misrepresented; you must not
+//    claim that you wrote the original software. If you use this software
+//    in a product, an acknowledgement in the product documentation would be
+//    appreciated but is not required.
+// 2. Altered source versions must be plainly marked as such, and must not be
+//    misrepresented as being the original software.
+// 3. This notice may not be removed or altered from any source distribution.
+
+#include "TaskScheduler.h"
+#include "Timer.h"
+
+#include <stdio.h>
+#include <inttypes.h>
+
+#ifndef _WIN32
+	#include <string.h>
+#endif
+
+using namespace enki;
+
+
+
+TaskScheduler g_TS;
+
+// Sums the values in [m_Offset, m_Offset + m_SetSize ) into per thread partial sums
+struct ParallelSumTaskSet : ITaskSet
+{
+	struct Count
+	{
+		// prevent false sharing.
+		uint64_t	count;
+		char		cacheline[64];
+	};
+	Count*    m_pPartialSums;
+	uint32_t  m_NumPartialSums;
+	uint64_t  m_Offset;
+
+	ParallelSumTaskSet( uint32_t size_, uint64_t offset_ ) : m_pPartialSums(NULL), m_NumPartialSums(0), m_Offset(offset_) { m_SetSize = size_; }
+	virtual ~ParallelSumTaskSet()
+	{
+		delete[] m_pPartialSums;
+	}
+
+	void Init()
+	{
+		delete[] m_pPartialSums;
+		m_NumPartialSums = g_TS.GetNumTaskThreads();
+		m_pPartialSums = new Count[ m_NumPartialSums ];
+		memset( m_pPartialSums, 0, sizeof(Count)*m_NumPartialSums );
+	}
+
+	uint64_t GetSum() const
+	{
+		uint64_t sum = 0;
+		for( uint32_t i = 0; i < m_NumPartialSums; ++i )
+		{
+			sum += m_pPartialSums[i].count;
+		}
+		return sum;
+	}
+
+	virtual void    ExecuteRange( TaskSetPartition range, uint32_t threadnum )
+	{
+		uint64_t sum = m_pPartialSums[threadnum].count;
+		for( uint64_t i = range.start + m_Offset; i < range.end + m_Offset; ++i )
+		{
+			sum += i + 1;
+		}
+		m_pPartialSums[threadnum].count = sum;
+	}
+};
+
+// Runs after both halves of the sum have completed, without any thread waiting for them.
+struct ReductionTaskSet : ITaskSet
+{
+	ParallelSumTaskSet* m_pLower;
+	ParallelSumTaskSet* m_pUpper;
+	Dependency          m_DependencyLower;
+	Dependency          m_DependencyUpper;
+	uint64_t            m_FinalSum;
+
+	ReductionTaskSet( ParallelSumTaskSet* pLower_, ParallelSumTaskSet* pUpper_ )
+		: m_pLower( pLower_ ), m_pUpper( pUpper_ ), m_FinalSum(0)
+	{
+		SetDependency( m_DependencyLower, m_pLower );
+		SetDependency( m_DependencyUpper, m_pUpper );
+	}
+
+	virtual void    ExecuteRange( TaskSetPartition range, uint32_t threadnum )
+	{
+		m_FinalSum = m_pLower->GetSum() + m_pUpper->GetSum();
+	}
+};
+
+// Runs after the reduction.
+struct PrintTaskSet : ITaskSet
+{
+	ReductionTaskSet*   m_pReduction;
+	Dependency          m_Dependency;
+
+	PrintTaskSet( ReductionTaskSet* pReduction_ ) : m_pReduction( pReduction_ )
+	{
+		SetDependency( m_Dependency, m_pReduction );
+	}
+
+	virtual void    ExecuteRange( TaskSetPartition range, uint32_t threadnum )
+	{
+		printf("Reduction complete on thread %u, sum: %" PRIu64 "\n", threadnum, m_pReduction->m_FinalSum );
+	}
+};
+
+static const int RUNS		= 10;
+
+int main(int argc, const char * argv[])
+{
+	g_TS.Initialize();
+
+	const uint32_t halfSize = 5 * 1024 * 1024;
+	ParallelSumTaskSet lower( halfSize, 0 );
+	ParallelSumTaskSet upper( halfSize, halfSize );
+	ReductionTaskSet   reduction( &lower, &upper );
+	PrintTaskSet       print( &reduction );
+
+	uint64_t serialSum = 0;
+	for( uint64_t i = 0; i < 2 * (uint64_t)halfSize; ++i )
+	{
+		serialSum += i + 1;
+	}
+
+	for( int run = 0; run < RUNS; ++run )
+	{
+		lower.Init();
+		upper.Init();
+
+		Timer tParallel;
+		tParallel.Start();
+
+		// only the tasks without dependencies are added, reduction and print are launched on completion
+		g_TS.AddTaskSetToPipe( &lower );
+		g_TS.AddTaskSetToPipe( &upper );
+
+		g_TS.WaitforTaskSet( &print );
+
+		tParallel.Stop();
+
+		printf("Run %d complete in \t%fms,\t sum: %" PRIu64 ", serial sum: %" PRIu64 "%s\n\n",
+			run, tParallel.GetTimeMS(), reduction.m_FinalSum, serialSum,
+			reduction.m_FinalSum == serialSum ? "" : " ERROR" );
+	}
+
+	return 0;
+}
@@ -0,0 +1,129 @@
+// Copyright (c) 2013 Doug Binks
+// 
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any damages
+// arising from the use of this software.
+// 
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+// 
+// 1. The origin of this software must not be misrepresented; you must not
+//    claim that you wrote the original software. If you use this software
+//    in a product, an acknowledgement in the product documentation would be
+//    appreciated but is not required.
+// 2. Altered source versions must be plainly marked as such, and must not be
+//    misrepresented as being the original software.
+// 3. This notice may not be removed or altered from any source distribution.
+
+#include "TaskScheduler.h"
+#include "Timer.h"
+
+#include <stdio.h>
+#include <inttypes.h>
+
+#ifndef _WIN32
+	#include <string.h>
+#endif
+
+using namespace enki;
+
+
+// Sweeps ITaskSet::m_MinRange for the parallel sum from Example.cpp, to show the
+// effect of grain size on a set of 10M elements each with very little work.
+
+TaskScheduler g_TS;
+
+struct ParallelSumTaskSet : ITaskSet
+{
+	struct Count
+	{
+		// prevent false sharing.
+		uint64_t	count;
+		char		cacheline[64];
+	};
+	Count*    m_pPartialSums;
+	uint32_t  m_NumPartialSums;
+	volatile int32_t m_NumRanges;
+
+	ParallelSumTaskSet( uint32_t size_ ) : m_pPartialSums(NULL), m_NumPartialSums(0), m_NumRanges(0) { m_SetSize = size_; }
+	virtual ~ParallelSumTaskSet()
+	{
+		delete[] m_pPartialSums;
+	}
+
+	void Init()
+	{
+		delete[] m_pPartialSums;
+		m_NumPartialSums = g_TS.GetNumTaskThreads();
+		m_pPartialSums = new Count[ m_NumPartialSums ];
+		memset( m_pPartialSums, 0, sizeof(Count)*m_NumPartialSums );
+		m_NumRanges = 0;
+	}
+
+	uint64_t GetSum() const
+	{
+		uint64_t sum = 0;
+		for( uint32_t i = 0; i < m_NumPartialSums; ++i )
+		{
+			sum += m_pPartialSums[i].count;
+		}
+		return sum;
+	}
+
+	virtual void    ExecuteRange( TaskSetPartition range, uint32_t threadnum )
+	{
+		AtomicAdd( &m_NumRanges, 1 );
+		uint64_t sum = m_pPartialSums[threadnum].count;
+		for( uint64_t i = range.start; i < range.end; ++i )
+		{
+			sum += i + 1;
+		}
+		m_pPartialSums[threadnum].count = sum;
+	}
+};
+
+static const int WARMUPS	= 5;
+static const int RUNS		= 10;
+static const int REPEATS	= RUNS + WARMUPS;
+
+static const uint32_t SET_SIZE = 10 * 1024 * 1024;
+
+int main(int argc, const char * argv[])
+{
+	uint32_t maxThreads = GetNumHardwareThreads();
+	uint64_t expectedSum = (uint64_t)SET_SIZE * ( SET_SIZE + 1 ) / 2;
+
+	printf("Hardware Threads, Min Range, Ranges, Time ms\n" );
+	for( uint32_t numThreads = 1; numThreads <= maxThreads; ++numThreads )
+	{
+		g_TS.Initialize(numThreads);
+		ParallelSumTaskSet task( SET_SIZE );
+		for( uint32_t minRange = 1; minRange <= SET_SIZE; minRange *= 8 )
+		{
+			task.m_MinRange = minRange;
+			double avTime = 0.0;
+			for( int run = 0; run< REPEATS; ++run )
+			{
+				task.Init();
+				Timer tParallel;
+				tParallel.Start();
+				g_TS.AddTaskSetToPipe( &task );
+				g_TS.WaitforTaskSet( &task );
+				tParallel.Stop();
+
+				if( task.GetSum() != expectedSum )
+				{
+					printf("ERROR: sum %" PRIu64 " expected %" PRIu64 "\n", task.GetSum(), expectedSum );
+				}
+				if( run >= WARMUPS )
+				{
+					avTime += tParallel.GetTimeMS() / RUNS;
+				}
+			}
+			printf("%d, %d, %d, %f\n", numThreads, minRange, task.m_NumRanges, avTime );
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,97 @@
+// Copyright (c) 2013 Doug Binks
+// 
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any damages
+// arising from the use of this software.
+// 
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+// 
+// 1. The origin of this software must not be misrepresented; you must not
+//    claim that you wrote the original software. If you use this software
+//    in a product, an acknowledgement in the product documentation would be
+//    appreciated but is not required.
+// 2. Altered source versions must be plainly marked as such, and must not be
+//    misrepresented as being the original software.
+// 3. This notice may not be removed or altered from any source distribution.
+
+#include "TaskScheduler.h"
+#include "Timer.h"
+
+#include <stdio.h>
+#include <inttypes.h>
+
+#ifndef _WIN32
+	#include <string.h>
+#endif
+
+using namespace enki;
+
+
+// Lambda task sets with MakeTaskSet and ParallelFor - requires C++ 11
+
+TaskScheduler g_TS;
+
+static const uint32_t SET_SIZE = 10 * 1024 * 1024;
+
+struct Count
+{
+	// prevent false sharing.
+	uint64_t	count;
+	char		cacheline[64];
+};
+
+int main(int argc, const char * argv[])
+{
+	g_TS.Initialize();
+
+	uint32_t numThreads = g_TS.GetNumTaskThreads();
+	Count* pPartialSums = new Count[ numThreads ];
+	memset( pPartialSums, 0, sizeof(Count)*numThreads );
+
+	// sum with a lambda task set, which gets the range and thread number
+	auto sumTask = MakeTaskSet( SET_SIZE, [pPartialSums]( TaskSetPartition range, uint32_t threadnum )
+	{
+		uint64_t sum = pPartialSums[threadnum].count;
+		for( uint64_t i = range.start; i < range.end; ++i )
+		{
+			sum += i + 1;
+		}
+		pPartialSums[threadnum].count = sum;
+	} );
+
+	Timer tSum;
+	tSum.Start();
+	g_TS.AddTaskSetToPipe( &sumTask );
+	g_TS.WaitforTaskSet( &sumTask );
+	tSum.Stop();
+
+	uint64_t sum = 0;
+	for( uint32_t i = 0; i < numThreads; ++i )
+	{
+		sum += pPartialSums[i].count;
+	}
+	printf("MakeTaskSet sum: %" PRIu64 " in %fms\n", sum, tSum.GetTimeMS() );
+
+	// ParallelFor calls the lambda per index, and waits for completion
+	float* pValues = new float[ SET_SIZE ];
+	Timer tFor;
+	tFor.Start();
+	g_TS.ParallelFor( 0, SET_SIZE, [pValues]( uint32_t i )
+	{
+		pValues[i] = 0.5f * (float)i;
+	}, 4096 );
+	tFor.Stop();
+
+	uint32_t numErrors = 0;
+	for( uint32_t i = 0; i < SET_SIZE; ++i )
+	{
+		if( pValues[i] != 0.5f * (float)i ) { ++numErrors; }
+	}
+	printf("ParallelFor filled %d values in %fms, %d errors\n", SET_SIZE, tFor.GetTimeMS(), numErrors );
+
+	delete[] pValues;
+	delete[] pPartialSums;
+	return 0;
+}
@@ -0,0 +1,77 @@
+// Copyright (c) 2013 Doug Binks
+// 
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any damages
+// arising from the use of this software.
+// 
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+// 
+// 1. The origin of this software must not be misrepresented; you must not
+//    claim that you wrote the original software. If you use this software
+//    in a product, an acknowledgement in the product documentation would be
+//    appreciated but is not required.
+// 2. Altered source versions must be plainly marked as such, and must not be
+//    misrepresented as being the original software.
+// 3. This notice may not be removed or altered from any source distribution.
+
+#include "TaskScheduler.h"
+
+#include <stdio.h>
+
+using namespace enki;
+
+
+
+TaskScheduler g_TS;
+
+// Pinned tasks run on the thread given by threadNum, for example to call an API
+// which must be called from the main thread (thread 0).
+struct PinnedTask : IPinnedTask
+{
+	PinnedTask( uint32_t threadNum_ ) : IPinnedTask( threadNum_ ) {}
+
+	virtual void    Execute()
+	{
+		printf("This will run on thread %u\n", threadNum );
+	}
+};
+
+struct ParallelTaskSet : ITaskSet
+{
+	PinnedTask m_MainThreadTask;
+
+	ParallelTaskSet() : m_MainThreadTask( 0 ) {}
+
+	virtual void    ExecuteRange( TaskSetPartition range, uint32_t threadnum )
+	{
+		printf("This could run on any thread, currently thread %u\n", threadnum );
+
+		// issue work for the main thread from within a task
+		g_TS.AddPinnedTask( &m_MainThreadTask );
+	}
+};
+
+static const int RUNS		= 10;
+
+int main(int argc, const char * argv[])
+{
+	g_TS.Initialize();
+
+	PinnedTask lastThreadTask( g_TS.GetNumTaskThreads() - 1 );
+	for( int run = 0; run < RUNS; ++run )
+	{
+		ParallelTaskSet task;
+		g_TS.AddTaskSetToPipe( &task );
+		g_TS.AddPinnedTask( &lastThreadTask );
+
+		// waiting on the task set will run pinned tasks for this thread as well,
+		// but the pinned task added by the task set may not have been added yet
+		g_TS.WaitforTaskSet( &task );
+		g_TS.WaitforPinnedTask( &task.m_MainThreadTask );
+		g_TS.WaitforPinnedTask( &lastThreadTask );
+	}
+
+	return 0;
+}
@@ -0,0 +1,116 @@
+// Copyright (c) 2013 Doug Binks
+// 
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any damages
+// arising from the use of this software.
+// 
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+// 
+// 1. The origin of this software must not be misrepresented; you must not
+//    claim that you wrote the original software. If you use this software
+//    in a product, an acknowledgement in the product documentation would be
+//    appreciated but is not required.
+// 2. Altered source versions must be plainly marked as such, and must not be
+//    misrepresented as being the original software.
+// 3. This notice may not be removed or altered from any source distribution.
+
+#include "TaskScheduler.h"
+#include "Timer.h"
+
+#include <stdio.h>
+
+using namespace enki;
+
+
+// Measures the latency of a task under a saturating load of low priority tasks,
+// with the latency task at high priority and then at the same low priority as the load.
+
+TaskScheduler g_TS;
+
+static const uint32_t numLoadTasks		= 64;
+static const double   loadTaskTimeMS	= 0.5;
+
+struct LoadTask : ITaskSet
+{
+	LoadTask() { m_Priority = TASK_PRIORITY_LOW; }
+
+	virtual void    ExecuteRange( TaskSetPartition range, uint32_t threadnum )
+	{
+		// busy work
+		Timer timer;
+		timer.Start();
+		while( timer.GetTimeMS() < loadTaskTimeMS ) {}
+	}
+};
+
+struct LatencyTask : ITaskSet
+{
+	Timer  m_Timer;
+	double m_LatencyMS;
+
+	virtual void    ExecuteRange( TaskSetPartition range, uint32_t threadnum )
+	{
+		m_LatencyMS = m_Timer.GetTimeMS();
+	}
+};
+
+static const int WARMUPS	= 2;
+static const int RUNS		= 10;
+static const int REPEATS	= RUNS + WARMUPS;
+
+int main(int argc, const char * argv[])
+{
+	// need at least one task thread as the main thread does not run tasks whilst measuring
+	uint32_t numThreads = GetNumHardwareThreads();
+	if( numThreads < 2 )
+	{
+		numThreads = 2;
+	}
+	g_TS.Initialize( numThreads );
+
+	LoadTask    loadTasks[ numLoadTasks ];
+	LatencyTask latencyTask;
+
+	const TaskPriority latencyPriorities[] = { TASK_PRIORITY_HIGH, TASK_PRIORITY_LOW };
+	const char*        latencyPriorityNames[] = { "high", "low" };
+	double             avLatencies[2];
+
+	for( int p = 0; p < 2; ++p )
+	{
+		latencyTask.m_Priority = latencyPriorities[p];
+		double avLatency = 0.0;
+		for( int run = 0; run < REPEATS; ++run )
+		{
+			for( uint32_t i = 0; i < numLoadTasks; ++i )
+			{
+				g_TS.AddTaskSetToPipe( &loadTasks[i] );
+			}
+
+			latencyTask.m_Timer.Reset();
+			latencyTask.m_Timer.Start();
+			g_TS.AddTaskSetToPipe( &latencyTask );
+
+			// spin without running tasks so only task threads pick up the latency task
+			while( !latencyTask.GetIsComplete() ) {}
+
+			printf("Run %d: %s priority task latency %fms\n", run, latencyPriorityNames[p], latencyTask.m_LatencyMS );
+			if( run >= WARMUPS )
+			{
+				avLatency += latencyTask.m_LatencyMS / RUNS;
+			}
+
+			g_TS.WaitforAll();
+		}
+		avLatencies[p] = avLatency;
+	}
+
+	printf("\n%d threads, %d low priority load tasks of %fms\n", numThreads, numLoadTasks, loadTaskTimeMS );
+	for( int p = 0; p < 2; ++p )
+	{
+		printf("Average %s priority task latency: %fms\n", latencyPriorityNames[p], avLatencies[p] );
+	}
+
+	return 0;
+}
@@ -20,6 +20,12 @@
 
 #include <stdint.h>
 
+#ifdef ENKITS_USE_STD_ATOMIC
+    // std::atomic backend, see the ENKITS_USE_STD_ATOMIC CMake option. Uses explicit memory orders,
+    // so is correct on weakly ordered CPUs such as ARM and can be checked with ThreadSanitizer.
+    #include <atomic>
+#endif
+
 #ifdef _WIN32
     #define WIN32_LEAN_AND_MEAN
     #include <Windows.h>
@@ -34,21 +40,139 @@
     // Memory Barriers to prevent CPU and Compiler re-ordering
     #define BASE_MEMORYBARRIER_ACQUIRE() _ReadWriteBarrier()
     #define BASE_MEMORYBARRIER_RELEASE() _ReadWriteBarrier()
+    // Full barrier also prevents CPU store-load re-ordering, needed by algorithms such as Chase-Lev
+    #define BASE_MEMORYBARRIER_FULL()    MemoryBarrier()
+    // Spin loop hint (PAUSE on x86), reduces power and frees resources for the other hyperthread
+    #define BASE_CPU_PAUSE()             YieldProcessor()
     #define BASE_ALIGN(x) __declspec( align( x ) ) 
 
 #else
     #define BASE_MEMORYBARRIER_ACQUIRE() __asm__ __volatile__("": : :"memory")  
     #define BASE_MEMORYBARRIER_RELEASE() __asm__ __volatile__("": : :"memory")  
+    #define BASE_MEMORYBARRIER_FULL()    __sync_synchronize()
+    #if defined(__i386__) || defined(__x86_64__)
+        #define BASE_CPU_PAUSE()         __builtin_ia32_pause()
+    #elif defined(__aarch64__)
+        #define BASE_CPU_PAUSE()         __asm__ __volatile__("yield": : :"memory")
+    #else
+        #define BASE_CPU_PAUSE()         __asm__ __volatile__("": : :"memory")
+    #endif
 	#define BASE_ALIGN(x)  __attribute__ ((aligned( x )))
 #endif
 
+#ifdef ENKITS_USE_STD_ATOMIC
+    // the compiler only barriers above are not enough on weakly ordered CPUs
+    #undef  BASE_MEMORYBARRIER_ACQUIRE
+    #undef  BASE_MEMORYBARRIER_RELEASE
+    #undef  BASE_MEMORYBARRIER_FULL
+    #define BASE_MEMORYBARRIER_ACQUIRE() std::atomic_thread_fence( std::memory_order_acquire )
+    #define BASE_MEMORYBARRIER_RELEASE() std::atomic_thread_fence( std::memory_order_release )
+    #define BASE_MEMORYBARRIER_FULL()    std::atomic_thread_fence( std::memory_order_seq_cst )
+#endif
+
 namespace enki
 {
+    // Memory orders for the atomic operations below, with the meaning of std::memory_order.
+    // Shared variables are declared volatile, and must only be accessed concurrently through these.
+    // The default backend targets x86: read-modify-write operations are full barriers whatever the
+    // order, and loads and stores are volatile accesses with compiler barriers, as x86 does not
+    // reorder loads with loads or stores with stores. MEMORY_ORDER_SEQ_CST stores add a full barrier.
+    // The ENKITS_USE_STD_ATOMIC backend maps these to std::atomic operations.
+    enum MemoryOrder
+    {
+        MEMORY_ORDER_RELAXED,
+        MEMORY_ORDER_ACQUIRE,
+        MEMORY_ORDER_RELEASE,
+        MEMORY_ORDER_ACQ_REL,
+        MEMORY_ORDER_SEQ_CST,
+    };
+
+#ifdef ENKITS_USE_STD_ATOMIC
+    inline std::memory_order ToStdMemoryOrder( MemoryOrder order )
+    {
+        switch( order )
+        {
+        case MEMORY_ORDER_RELAXED: return std::memory_order_relaxed;
+        case MEMORY_ORDER_ACQUIRE: return std::memory_order_acquire;
+        case MEMORY_ORDER_RELEASE: return std::memory_order_release;
+        case MEMORY_ORDER_ACQ_REL: return std::memory_order_acq_rel;
+        default:                   return std::memory_order_seq_cst;
+        }
+    }
+
+    // a failed compare and swap only loads, so cannot have release semantics
+    inline std::memory_order ToStdFailureMemoryOrder( MemoryOrder order )
+    {
+        switch( order )
+        {
+        case MEMORY_ORDER_RELEASE: return std::memory_order_relaxed;
+        case MEMORY_ORDER_ACQ_REL: return std::memory_order_acquire;
+        default:                   return ToStdMemoryOrder( order );
+        }
+    }
+
+    // Shared variables stay volatile T rather than std::atomic<T>, so that the types in the public
+    // headers and the C interface do not depend on this option. Accessing them through std::atomic<T>
+    // is not defined by the standard, and relies on lock free std::atomic<T> having the same size and
+    // representation as T, which holds for all supported compilers and is checked here.
+    static_assert( ATOMIC_BOOL_LOCK_FREE == 2 && ATOMIC_INT_LOCK_FREE == 2 && ATOMIC_LLONG_LOCK_FREE == 2 &&
+                   ATOMIC_POINTER_LOCK_FREE == 2, "ENKITS_USE_STD_ATOMIC requires lock free atomics" );
+
+    template<typename T> inline std::atomic<T>* AsStdAtomic( const volatile T* pValue )
+    {
+        static_assert( sizeof( std::atomic<T> ) == sizeof( T ), "std::atomic<T> must have the same size as T" );
+        #ifdef __cpp_lib_atomic_is_always_lock_free
+            static_assert( std::atomic<T>::is_always_lock_free, "std::atomic<T> must be lock free" );
+        #endif
+        return reinterpret_cast<std::atomic<T>*>( const_cast<T*>( pValue ) );
+    }
+#endif
+
+    // Atomically loads *pSrc
+    template<typename T> inline T AtomicLoad( const volatile T* pSrc, MemoryOrder order = MEMORY_ORDER_SEQ_CST )
+    {
+        #ifdef ENKITS_USE_STD_ATOMIC
+            return AsStdAtomic( pSrc )->load( ToStdMemoryOrder( order ) );
+        #else
+            T value = *pSrc;
+            if( MEMORY_ORDER_RELAXED != order )
+            {
+                BASE_MEMORYBARRIER_ACQUIRE();
+            }
+            return value;
+        #endif
+    }
+
+    // T of AtomicStore is deduced from pDest only, so values convert as for assignment
+    template<typename T> struct AtomicValueType { typedef T type; };
+
+    // Atomically stores value to *pDest
+    template<typename T> inline void AtomicStore( volatile T* pDest, typename AtomicValueType<T>::type value, MemoryOrder order = MEMORY_ORDER_SEQ_CST )
+    {
+        #ifdef ENKITS_USE_STD_ATOMIC
+            AsStdAtomic( pDest )->store( value, ToStdMemoryOrder( order ) );
+        #else
+            if( MEMORY_ORDER_RELAXED != order )
+            {
+                BASE_MEMORYBARRIER_RELEASE();
+            }
+            *pDest = value;
+            if( MEMORY_ORDER_SEQ_CST == order )
+            {
+                BASE_MEMORYBARRIER_FULL();
+            }
+        #endif
+    }
+
     // Atomically performs: if( *pDest == compareWith ) { *pDest = swapTo; }
     // returns old *pDest (so if successfull, returns compareWith)
-    inline uint32_t AtomicCompareAndSwap( volatile uint32_t* pDest, uint32_t swapTo, uint32_t compareWith )
+    inline uint32_t AtomicCompareAndSwap( volatile uint32_t* pDest, uint32_t swapTo, uint32_t compareWith, MemoryOrder order = MEMORY_ORDER_SEQ_CST )
     {
-       #ifdef _WIN32
+        (void)order; // platform read-modify-write operations are full barriers whatever the order
+       #if defined( ENKITS_USE_STD_ATOMIC )
+            AsStdAtomic( pDest )->compare_exchange_strong( compareWith, swapTo, ToStdMemoryOrder( order ), ToStdFailureMemoryOrder( order ) );
+            return compareWith;
+       #elif defined( _WIN32 )
 			// assumes two's complement - unsigned / signed conversion leads to same bit pattern
             return _InterlockedCompareExchange( (volatile long*)pDest,swapTo, compareWith );
         #else
@@ -56,9 +180,13 @@ namespace enki
         #endif      
     }
 
-    inline uint64_t AtomicCompareAndSwap( volatile uint64_t* pDest, uint64_t swapTo, uint64_t compareWith )
+    inline uint64_t AtomicCompareAndSwap( volatile uint64_t* pDest, uint64_t swapTo, uint64_t compareWith, MemoryOrder order = MEMORY_ORDER_SEQ_CST )
     {
-       #ifdef _WIN32
+        (void)order; // platform read-modify-write operations are full barriers whatever the order
+       #if defined( ENKITS_USE_STD_ATOMIC )
+            AsStdAtomic( pDest )->compare_exchange_strong( compareWith, swapTo, ToStdMemoryOrder( order ), ToStdFailureMemoryOrder( order ) );
+            return compareWith;
+       #elif defined( _WIN32 )
 			// assumes two's complement - unsigned / signed conversion leads to same bit pattern
             return _InterlockedCompareExchange64( (__int64 volatile*)pDest, swapTo, compareWith );
         #else
@@ -66,14 +194,44 @@ namespace enki
         #endif      
     }	
 
+    // Atomically performs: if( *pDest == compareWith ) { *pDest = swapTo; }
+    // returns old *pDest (so if successfull, returns compareWith)
+    template<typename T> inline T* AtomicCompareAndSwapPointer( T* volatile* pDest, T* swapTo, T* compareWith, MemoryOrder order = MEMORY_ORDER_SEQ_CST )
+    {
+        (void)order; // platform read-modify-write operations are full barriers whatever the order
+       #if defined( ENKITS_USE_STD_ATOMIC )
+            AsStdAtomic( pDest )->compare_exchange_strong( compareWith, swapTo, ToStdMemoryOrder( order ), ToStdFailureMemoryOrder( order ) );
+            return compareWith;
+       #elif defined( _WIN32 )
+            return (T*)_InterlockedCompareExchangePointer( (void* volatile*)pDest, swapTo, compareWith );
+        #else
+            return __sync_val_compare_and_swap( pDest, compareWith, swapTo );
+        #endif
+    }
+
     // Atomically performs: tmp = *pDest; *pDest += value; return tmp;
-    inline int32_t AtomicAdd( volatile int32_t* pDest, int32_t value )
+    inline int32_t AtomicAdd( volatile int32_t* pDest, int32_t value, MemoryOrder order = MEMORY_ORDER_SEQ_CST )
     {
-       #ifdef _WIN32
+        (void)order; // platform read-modify-write operations are full barriers whatever the order
+       #if defined( ENKITS_USE_STD_ATOMIC )
+            return AsStdAtomic( pDest )->fetch_add( value, ToStdMemoryOrder( order ) );
+       #elif defined( _WIN32 )
             return _InterlockedExchangeAdd( (long*)pDest, value );
         #else
-            return __sync_add_and_fetch( pDest, value );
+            return __sync_fetch_and_add( pDest, value );
         #endif      
     }
 
-}
\ No newline at end of file
+    inline int64_t AtomicAdd( volatile int64_t* pDest, int64_t value, MemoryOrder order = MEMORY_ORDER_SEQ_CST )
+    {
+        (void)order; // platform read-modify-write operations are full barriers whatever the order
+       #if defined( ENKITS_USE_STD_ATOMIC )
+            return AsStdAtomic( pDest )->fetch_add( value, ToStdMemoryOrder( order ) );
+       #elif defined( _WIN32 )
+            return _InterlockedExchangeAdd64( (__int64 volatile*)pDest, value );
+        #else
+            return __sync_fetch_and_add( pDest, value );
+        #endif
+    }
+
+}
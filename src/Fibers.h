@@ -0,0 +1,175 @@
+// Copyright (c) 2013 Doug Binks
+// 
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any damages
+// arising from the use of this software.
+// 
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+// 
+// 1. The origin of this software must not be misrepresented; you must not
+//    claim that you wrote the original software. If you use this software
+//    in a product, an acknowledgement in the product documentation would be
+//    appreciated but is not required.
+// 2. Altered source versions must be plainly marked as such, and must not be
+//    misrepresented as being the original software.
+// 3. This notice may not be removed or altered from any source distribution.
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <assert.h>
+
+// Fibers - user mode execution contexts each with their own stack, switched cooperatively.
+// Windows uses the fiber API, other platforms ucontext. A fiber must only be switched to
+// on the thread which created it, as compilers may cache thread local addresses.
+
+namespace enki
+{
+    typedef void (*FiberFunction)( void* pArg );
+}
+
+#ifdef _WIN32
+
+	#define WIN32_LEAN_AND_MEAN
+	#include <Windows.h>
+
+namespace enki
+{
+    struct fiberid_t
+    {
+        LPVOID          fiber;
+        FiberFunction   func;
+        void*           pArg;
+        bool            bConvertedThread;
+    };
+
+    inline void WINAPI FiberStart( LPVOID pFiberID )
+    {
+        fiberid_t* pFiber = (fiberid_t*)pFiberID;
+        pFiber->func( pFiber->pArg );
+    }
+
+    // func_ must not return, switch to another fiber instead
+    // CreateFiber stacks have a guard page, so an overflow faults rather than corrupting memory
+    inline void FiberCreate( fiberid_t& fiberid, size_t stackSize, FiberFunction func_, void* pArg_ )
+    {
+        fiberid.func  = func_;
+        fiberid.pArg  = pArg_;
+        fiberid.bConvertedThread = false;
+        fiberid.fiber = CreateFiber( stackSize, FiberStart, &fiberid );
+        assert( fiberid.fiber );
+    }
+
+    inline void FiberDelete( fiberid_t& fiberid )
+    {
+        DeleteFiber( fiberid.fiber );
+    }
+
+    // Makes the calling thread's own context a fiber, so it can switch to other fibers
+    inline void FiberConvertThread( fiberid_t& fiberid )
+    {
+        fiberid.func  = NULL;
+        fiberid.pArg  = NULL;
+        fiberid.fiber = ConvertThreadToFiber( NULL );
+        fiberid.bConvertedThread = NULL != fiberid.fiber;
+        if( !fiberid.fiber )
+        {
+            // already a fiber
+            fiberid.fiber = GetCurrentFiber();
+        }
+    }
+
+    // Call on the converted thread when it is running its own context
+    inline void FiberConvertBackToThread( fiberid_t& fiberid )
+    {
+        if( fiberid.bConvertedThread )
+        {
+            ConvertFiberToThread();
+        }
+    }
+
+    inline void FiberSwitch( fiberid_t&, fiberid_t& to )
+    {
+        SwitchToFiber( to.fiber );
+    }
+}
+
+#else // posix
+
+	#include <ucontext.h>
+	#include <sys/mman.h>
+	#include <unistd.h>
+
+namespace enki
+{
+    struct fiberid_t
+    {
+        ucontext_t      context;
+        FiberFunction   func;
+        void*           pArg;
+        char*           pStack;     // mapping, including the guard page
+        size_t          stackMapSize;
+    };
+
+    // makecontext only passes int arguments, so the fiberid_t pointer is split in two
+    inline void FiberStart( uint32_t fiberHigh, uint32_t fiberLow )
+    {
+        fiberid_t* pFiber = (fiberid_t*)( ( (uintptr_t)fiberHigh << 16 << 16 ) | (uintptr_t)fiberLow );
+        pFiber->func( pFiber->pArg );
+    }
+
+    // func_ must not return, switch to another fiber instead
+    // The stack is mapped with an inaccessible guard page below it, so an overflow faults
+    // rather than silently corrupting memory
+    inline void FiberCreate( fiberid_t& fiberid, size_t stackSize, FiberFunction func_, void* pArg_ )
+    {
+        size_t pageSize = (size_t)sysconf( _SC_PAGESIZE );
+        stackSize = ( stackSize + pageSize - 1 ) & ~( pageSize - 1 );
+        fiberid.func   = func_;
+        fiberid.pArg   = pArg_;
+        fiberid.stackMapSize = stackSize + pageSize;
+        void* pMap = mmap( NULL, fiberid.stackMapSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0 );
+        assert( MAP_FAILED != pMap );
+        fiberid.pStack = (char*)pMap;
+        int ret = mprotect( fiberid.pStack, pageSize, PROT_NONE ); // stacks grow down
+        assert( 0 == ret );
+        (void)ret;
+        getcontext( &fiberid.context );
+        fiberid.context.uc_stack.ss_sp   = fiberid.pStack + pageSize;
+        fiberid.context.uc_stack.ss_size = stackSize;
+        fiberid.context.uc_link          = NULL;
+        uintptr_t fiber = (uintptr_t)&fiberid;
+        makecontext( &fiberid.context, (void (*)())FiberStart, 2, (uint32_t)( fiber >> 16 >> 16 ), (uint32_t)fiber );
+    }
+
+    inline void FiberDelete( fiberid_t& fiberid )
+    {
+        munmap( fiberid.pStack, fiberid.stackMapSize );
+        fiberid.pStack = NULL;
+    }
+
+    // Makes the calling thread's own context a fiber, so it can switch to other fibers
+    inline void FiberConvertThread( fiberid_t& fiberid )
+    {
+        // swapcontext saves the thread's context when switching away
+        fiberid.func   = NULL;
+        fiberid.pArg   = NULL;
+        fiberid.pStack = NULL;
+        fiberid.stackMapSize = 0;
+    }
+
+    // Call on the converted thread when it is running its own context
+    inline void FiberConvertBackToThread( fiberid_t& )
+    {
+    }
+
+    inline void FiberSwitch( fiberid_t& from, fiberid_t& to )
+    {
+        swapcontext( &from.context, &to.context );
+    }
+}
+
+#endif
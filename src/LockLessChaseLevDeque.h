@@ -0,0 +1,180 @@
+// Copyright (c) 2013 Doug Binks
+// 
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any damages
+// arising from the use of this software.
+// 
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+// 
+// 1. The origin of this software must not be misrepresented; you must not
+//    claim that you wrote the original software. If you use this software
+//    in a product, an acknowledgement in the product documentation would be
+//    appreciated but is not required.
+// 2. Altered source versions must be plainly marked as such, and must not be
+//    misrepresented as being the original software.
+// 3. This notice may not be removed or altered from any source distribution.
+
+#pragma once
+
+#include <stdint.h>
+#include <assert.h>
+
+#include "Atomics.h"
+
+
+namespace enki
+{
+    // LockLessChaseLevDeque - Single writer, multiple reader work stealing deque, after
+    // Chase & Lev "Dynamic Circular Work-Stealing Deque" and Le et al. "Correct and Efficient
+    // Work-Stealing for Weak Memory Models", but with a fixed size buffer.
+    // Has the same interface as LockLessMultiReadPipe so can be used as a drop in replacement.
+    // The writer pushes and pops at the bottom (front), and only needs a CAS when taking the last item.
+    // Readers steal from the top (back) with a single CAS, and give up if they lose the race.
+    // Note: using log2 sizes so we do not need to clamp (multi-operation)
+    // T is the contained type
+    template<uint8_t cSizeLog2, typename T> class LockLessChaseLevDeque
+    {
+    public:
+        LockLessChaseLevDeque();
+        ~LockLessChaseLevDeque() {}
+
+        // ReaderTryReadBack returns false if we were unable to read
+        // This is thread safe for both multiple readers and the writer
+        bool ReaderTryReadBack(   T* pOut );
+
+        // WriterTryReadFront returns false if we were unable to read
+        // This is thread safe for the single writer, but should not be called by readers
+        bool WriterTryReadFront(  T* pOut );
+
+        // WriterTryWriteFront returns false if we were unable to write
+        // This is thread safe for the single writer, but should not be called by readers
+        bool WriterTryWriteFront( const T& in );
+
+        // IsPipeEmpty() is a utility function, not intended for general use
+        // Should only be used very prudently.
+        bool IsPipeEmpty() const
+        {
+            // bottom can transiently be one less than top whilst the writer reads the front
+            return 0 >= (int32_t)( AtomicLoad( &m_Bottom, MEMORY_ORDER_RELAXED ) - AtomicLoad( &m_Top, MEMORY_ORDER_RELAXED ) );
+        }
+
+		void Clear()
+		{
+			m_Bottom = 0;
+			m_Top    = 0;
+		}
+
+    private:
+        const static uint32_t           ms_cSize        = ( 1 << cSizeLog2 );
+        const static uint32_t           ms_cIndexMask   = ms_cSize - 1;
+
+        T                               m_Buffer[ ms_cSize ];
+
+        // top is written by readers (CAS) and bottom by the writer, so keep them
+        // on separate cache lines. Indices wrap, so differences are taken as signed.
+        // Padded rather than aligned, as over-aligned types need an aligned allocator
+        // when pipes are allocated with new.
+        char                            m_PadBeforeTop[ 64 ];
+        volatile uint32_t               m_Top;
+        char                            m_PadBeforeBottom[ 64 - sizeof( uint32_t ) ];
+        volatile uint32_t               m_Bottom;
+        char                            m_PadAfterBottom[ 64 - sizeof( uint32_t ) ];
+    };
+
+    template<uint8_t cSizeLog2, typename T> inline
+        LockLessChaseLevDeque<cSizeLog2,T>::LockLessChaseLevDeque()
+        : m_Top(0)
+        , m_Bottom(0)
+    {
+        assert( cSizeLog2 < 31 );
+    }
+
+    template<uint8_t cSizeLog2, typename T> inline
+        bool LockLessChaseLevDeque<cSizeLog2,T>::ReaderTryReadBack(   T* pOut )
+    {
+        uint32_t top = AtomicLoad( &m_Top, MEMORY_ORDER_ACQUIRE );
+
+        // top must be read before bottom, and the writer's store to bottom in
+        // WriterTryReadFront must not pass our load of it
+        BASE_MEMORYBARRIER_FULL();
+
+        // acquire pairs with the writer's release of bottom, so the data is visible
+        uint32_t bottom = AtomicLoad( &m_Bottom, MEMORY_ORDER_ACQUIRE );
+        if( 0 >= (int32_t)( bottom - top ) )
+        {
+            return false;
+        }
+
+        // read the data before the CAS, as once top is incremented the writer can overwrite it.
+        // If the CAS fails the data may be invalid, but we discard it.
+        T item = m_Buffer[ top & ms_cIndexMask ];
+
+        if( top != AtomicCompareAndSwap( &m_Top, top + 1, top ) )
+        {
+            // lost race with another reader or the writer, let caller try elsewhere
+            return false;
+        }
+
+        *pOut = item;
+        return true;
+    }
+
+    template<uint8_t cSizeLog2, typename T> inline
+        bool LockLessChaseLevDeque<cSizeLog2,T>::WriterTryReadFront(  T* pOut )
+    {
+        // reserve the bottom item before checking top, readers which see the
+        // reduced bottom will not try to take it.
+        uint32_t bottom = AtomicLoad( &m_Bottom, MEMORY_ORDER_RELAXED ) - 1;
+        AtomicStore( &m_Bottom, bottom, MEMORY_ORDER_RELAXED );
+
+        // store to bottom must be visible before the load of top (store-load ordering)
+        BASE_MEMORYBARRIER_FULL();
+        uint32_t top = AtomicLoad( &m_Top, MEMORY_ORDER_RELAXED );
+
+        int32_t numRemaining = (int32_t)( bottom - top );
+        if( numRemaining < 0 )
+        {
+            // empty, restore bottom
+            AtomicStore( &m_Bottom, bottom + 1, MEMORY_ORDER_RELAXED );
+            return false;
+        }
+
+        *pOut = m_Buffer[ bottom & ms_cIndexMask ];
+        if( numRemaining > 0 )
+        {
+            // more than one item, so no readers can be contending for this one
+            return true;
+        }
+
+        // last item, so race readers for it by incrementing top
+        bool bGotItem = top == AtomicCompareAndSwap( &m_Top, top + 1, top );
+
+        // either we or a reader took the item, so the deque is now empty with bottom == top
+        AtomicStore( &m_Bottom, bottom + 1, MEMORY_ORDER_RELAXED );
+        return bGotItem;
+    }
+
+    template<uint8_t cSizeLog2, typename T> inline
+        bool LockLessChaseLevDeque<cSizeLog2,T>::WriterTryWriteFront( const T& in )
+    {
+        // The writer 'owns' bottom, and readers can only reduce the amount of data in the pipe,
+        // so a stale top just means we might fail to write when there was space.
+        // acquire on top pairs with the readers' CAS, so they have read the data we overwrite
+        uint32_t bottom = AtomicLoad( &m_Bottom, MEMORY_ORDER_RELAXED );
+        uint32_t top    = AtomicLoad( &m_Top, MEMORY_ORDER_ACQUIRE );
+        if( (int32_t)( bottom - top ) >= (int32_t)ms_cSize )
+        {
+            return false;
+        }
+
+        m_Buffer[ bottom & ms_cIndexMask ] = in;
+
+        // We need to ensure the above write occurs prior to updating bottom,
+        // otherwise another thread might read before it's finished. The writer controls bottom.
+        AtomicStore( &m_Bottom, bottom + 1, MEMORY_ORDER_RELEASE );
+        return true;
+    }
+
+}
@@ -22,7 +22,6 @@
 #include <assert.h>
 
 #include "Atomics.h"
-#include <atomic>
 #include <string.h>
 
 
@@ -57,7 +56,7 @@ namespace enki
         // Should only be used very prudently.
         bool IsPipeEmpty() const
         {
-            return 0 == m_WriteIndex - m_ReadIndex;
+            return 0 == AtomicLoad( &m_WriteIndex, MEMORY_ORDER_RELAXED ) - AtomicLoad( &m_ReadIndex, MEMORY_ORDER_RELAXED );
         }
 
 		void Clear()
@@ -98,13 +97,14 @@ namespace enki
  
         uint32_t actualReadIndex;
 		
-        // We get hold of read index for consistency
-		uint32_t readIndexToUse  = m_ReadIndex;
+        // We get hold of read index for consistency. The indexes only bound the search,
+        // the flags synchronize access to the data, so can be read relaxed.
+		uint32_t readIndexToUse  = AtomicLoad( &m_ReadIndex, MEMORY_ORDER_RELAXED );
 		while(true)
         {
 
-			uint32_t writeIndex = m_WriteIndex;
-			uint32_t readIndex  = m_ReadIndex;
+			uint32_t writeIndex = AtomicLoad( &m_WriteIndex, MEMORY_ORDER_RELAXED );
+			uint32_t readIndex  = AtomicLoad( &m_ReadIndex, MEMORY_ORDER_RELAXED );
 			 // power of two sizes ensures we can use a simple calc without modulus
 			uint32_t numInPipe = writeIndex - readIndex;
 			if( 0 == numInPipe )
@@ -117,8 +117,8 @@ namespace enki
             actualReadIndex    = readIndexToUse & ms_cIndexMask;
 
             // Multiple potential readers mean we should check if the data is valid,
-            // using an atomic compare exchange
-            uint32_t previous = AtomicCompareAndSwap( &m_Flags[  actualReadIndex ], FLAG_INVALID, FLAG_CAN_READ );
+            // using an atomic compare exchange. Acquire pairs with the writer's release of the flag.
+            uint32_t previous = AtomicCompareAndSwap( &m_Flags[  actualReadIndex ], FLAG_INVALID, FLAG_CAN_READ, MEMORY_ORDER_ACQUIRE );
             if( FLAG_CAN_READ == previous )
             {
                break;
@@ -129,13 +129,13 @@ namespace enki
         // we update the read index using an atomic add, as we've only read one piece of data.
         // this ensure consistency of the read index, and the above loop ensures readers
         // only read from unread data
-        AtomicAdd(  (volatile int32_t*)&m_ReadIndex, 1 );
+        AtomicAdd(  (volatile int32_t*)&m_ReadIndex, 1, MEMORY_ORDER_RELAXED );
  
-        BASE_MEMORYBARRIER_ACQUIRE();
-        // now read data, ensuring we do so after above reads & CAS
+        // now read data, ordered after the CAS by its acquire
         *pOut = m_Buffer[ actualReadIndex ];
 
-        m_Flags[  actualReadIndex ] = FLAG_CAN_WRITE;
+        // release so our read of the data completes before the writer can overwrite it
+        AtomicStore( &m_Flags[  actualReadIndex ], FLAG_CAN_WRITE, MEMORY_ORDER_RELEASE );
 
 
         return true;
@@ -146,8 +146,8 @@ namespace enki
     {
          // We get hold of both values for consistency and to reduce false sharing
         // impacting more than one access
-        uint32_t writeIndex = m_WriteIndex;
-        uint32_t readIndex  = m_ReadIndex;
+        uint32_t writeIndex = AtomicLoad( &m_WriteIndex, MEMORY_ORDER_RELAXED );
+        uint32_t readIndex  = AtomicLoad( &m_ReadIndex, MEMORY_ORDER_RELAXED );
 
         // power of two sizes ensures we can use a simple calc without modulus
         uint32_t numInPipe = writeIndex - readIndex;
@@ -161,7 +161,7 @@ namespace enki
 
         // Multiple potential readers mean we should check if the data is valid,
         // using an atomic compare exchange - which acts as a form of lock (so not quite lockless really).
-        uint32_t previous = AtomicCompareAndSwap( &m_Flags[  actualReadIndex ], FLAG_INVALID, FLAG_CAN_READ );
+        uint32_t previous = AtomicCompareAndSwap( &m_Flags[  actualReadIndex ], FLAG_INVALID, FLAG_CAN_READ, MEMORY_ORDER_ACQUIRE );
         if( FLAG_CAN_READ != previous )
         {
             // this case should only be reachable if a reader has read from the back, so we now have no
@@ -169,16 +169,14 @@ namespace enki
             return false;
         }
  
-       // now read data, ensuring we do so after above reads & CAS
+       // now read data, ordered after the CAS by its acquire
         *pOut = m_Buffer[ actualReadIndex ];
 
-		m_Flags[  actualReadIndex ] = FLAG_CAN_WRITE;
+		AtomicStore( &m_Flags[  actualReadIndex ], FLAG_CAN_WRITE, MEMORY_ORDER_RELEASE );
 
-		BASE_MEMORYBARRIER_RELEASE();
-
-        // 32-bit aligned stores are atomic, and writer owns the write index
+        // writer owns the write index
         --writeIndex;
-        m_WriteIndex = writeIndex;
+        AtomicStore( &m_WriteIndex, writeIndex, MEMORY_ORDER_RELEASE );
         return true;
    }
 
@@ -190,8 +188,8 @@ namespace enki
         // the amount of data in the pipe.
         // We get hold of both values for consistency and to reduce false sharing
         // impacting more than one access
-        uint32_t writeIndex = m_WriteIndex;
-        uint32_t readIndex  = m_ReadIndex;
+        uint32_t writeIndex = AtomicLoad( &m_WriteIndex, MEMORY_ORDER_RELAXED );
+        uint32_t readIndex  = AtomicLoad( &m_ReadIndex, MEMORY_ORDER_RELAXED );
 
         // power of two sizes ensures we can use a simple calc without modulus
         uint32_t numInPipe = writeIndex - readIndex;
@@ -204,8 +202,9 @@ namespace enki
         // power of two sizes ensures we can perform AND for a modulus
         uint32_t actualWriteIndex    = writeIndex & ms_cIndexMask;
 
-        // a reader may still be reading this item, as there are multiple readers
-        while( m_Flags[ actualWriteIndex ] != FLAG_CAN_WRITE ) 
+        // a reader may still be reading this item, as there are multiple readers.
+        // Acquire pairs with the reader's release, so it has finished reading the data.
+        while( AtomicLoad( &m_Flags[ actualWriteIndex ], MEMORY_ORDER_ACQUIRE ) != FLAG_CAN_WRITE ) 
 		{
 			return false; // still being read, so have caught up with tail. 
 		}
@@ -214,15 +213,14 @@ namespace enki
         // as we are the only writer we can update the data without atomics
         //  whilst the write index has not been updated
         m_Buffer[ actualWriteIndex ] = in;
-        m_Flags[  actualWriteIndex ] = FLAG_CAN_READ;
 
-        // We need to ensure the above writes occur prior to updating the write index,
+        // We need to ensure the above write occurs prior to readers seeing the flag,
         // otherwise another thread might read before it's finished
-        BASE_MEMORYBARRIER_RELEASE();
+        AtomicStore( &m_Flags[  actualWriteIndex ], FLAG_CAN_READ, MEMORY_ORDER_RELEASE );
 
-        // 32-bit aligned stores are atomic, and the writer controls the write index
+        // the writer controls the write index
         ++writeIndex;
-        m_WriteIndex = writeIndex;
+        AtomicStore( &m_WriteIndex, writeIndex, MEMORY_ORDER_RELEASE );
         return true;
     }
 
@@ -0,0 +1,93 @@
+// Copyright (c) 2013 Doug Binks
+// 
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any damages
+// arising from the use of this software.
+// 
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+// 
+// 1. The origin of this software must not be misrepresented; you must not
+//    claim that you wrote the original software. If you use this software
+//    in a product, an acknowledgement in the product documentation would be
+//    appreciated but is not required.
+// 2. Altered source versions must be plainly marked as such, and must not be
+//    misrepresented as being the original software.
+// 3. This notice may not be removed or altered from any source distribution.
+
+#pragma once
+
+#include <stdint.h>
+#include <assert.h>
+
+#include "Atomics.h"
+
+
+namespace enki
+{
+    // LockLessMultiWriteIntrusiveList - Multiple writer, single reader thread safe intrusive list.
+    // T must have a member T* volatile pNext, which the list owns whilst T is in the list.
+    // Writers push to the head with a CAS. The reader takes the whole list in one CAS,
+    // so there is no ABA problem, and returns items in the order they were written.
+    template<typename T> class LockLessMultiWriteIntrusiveList
+    {
+    public:
+        LockLessMultiWriteIntrusiveList() : m_pHead(NULL) {}
+
+        // WriterWriteFront is thread safe for multiple writers and the reader
+        void WriterWriteFront( T* pItem );
+
+        // ReaderReadAll returns all items written, oldest first, linked by pNext, or NULL if empty.
+        // Thread safe with writers, and for multiple readers as each gets a distinct list.
+        T* ReaderReadAll();
+
+        // IsListEmpty() is a utility function, not intended for general use
+        bool IsListEmpty() const
+        {
+            return NULL == AtomicLoad( &m_pHead, MEMORY_ORDER_RELAXED );
+        }
+
+    private:
+        T* volatile m_pHead;
+    };
+
+    template<typename T> inline
+        void LockLessMultiWriteIntrusiveList<T>::WriterWriteFront( T* pItem )
+    {
+        T* pHead;
+        do
+        {
+            pHead = AtomicLoad( &m_pHead, MEMORY_ORDER_RELAXED );
+            pItem->pNext = pHead;
+        } while( pHead != AtomicCompareAndSwapPointer( &m_pHead, pItem, pHead ) );
+    }
+
+    template<typename T> inline
+        T* LockLessMultiWriteIntrusiveList<T>::ReaderReadAll()
+    {
+        T* pHead = AtomicLoad( &m_pHead, MEMORY_ORDER_RELAXED );
+        if( !pHead )
+        {
+            return NULL;
+        }
+        T* pPrev;
+        do
+        {
+            pPrev = pHead;
+            pHead = AtomicCompareAndSwapPointer<T>( &m_pHead, NULL, pPrev );
+        } while( pHead != pPrev );
+
+        // list is newest first, so reverse it
+        T* pReversed = NULL;
+        while( pHead )
+        {
+            T* pNext = pHead->pNext;
+            pHead->pNext = pReversed;
+            pReversed = pHead;
+            pHead = pNext;
+        }
+        return pReversed;
+    }
+
+}
@@ -0,0 +1,259 @@
+// Copyright (c) 2013 Doug Binks
+// 
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any damages
+// arising from the use of this software.
+// 
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+// 
+// 1. The origin of this software must not be misrepresented; you must not
+//    claim that you wrote the original software. If you use this software
+//    in a product, an acknowledgement in the product documentation would be
+//    appreciated but is not required.
+// 2. Altered source versions must be plainly marked as such, and must not be
+//    misrepresented as being the original software.
+// 3. This notice may not be removed or altered from any source distribution.
+
+#pragma once
+
+#include <stdint.h>
+#include <assert.h>
+#include <new>
+
+#include "Atomics.h"
+
+
+namespace enki
+{
+    // LockLessPipeChain - Single writer, multiple reader growable pipe built from a linked chain of
+    // fixed size single writer, multiple reader pipe segments (LockLessMultiReadPipe or LockLessChaseLevDeque).
+    // When all segments are full the writer appends a new segment, so writes only fail if allocation fails.
+    // Segments are never freed until the chain is destroyed, so readers can walk the chain safely,
+    // and once the chain has grown to the peak size no further allocations occur.
+    // Ordering is only preserved within a segment - the writer reads from its current write segment first.
+    // PIPE is the segment pipe type, T is the contained type
+    template<typename PIPE, typename T> class LockLessPipeChain
+    {
+    public:
+        LockLessPipeChain();
+        ~LockLessPipeChain();
+
+        // Reserve ensures at least numSegments_ segments are allocated.
+        // Should only be called by the writer, or before readers are started.
+        // returns false if allocation failed.
+        bool Reserve( uint32_t numSegments_ );
+
+        // ReaderTryReadBack returns false if we were unable to read
+        // This is thread safe for both multiple readers and the writer
+        bool ReaderTryReadBack(   T* pOut );
+
+        // WriterTryReadFront returns false if we were unable to read
+        // This is thread safe for the single writer, but should not be called by readers
+        bool WriterTryReadFront(  T* pOut );
+
+        // WriterTryWriteFront returns false if we were unable to write, which only
+        // occurs if all segments are full and a new segment could not be allocated.
+        // This is thread safe for the single writer, but should not be called by readers
+        bool WriterTryWriteFront( const T& in );
+
+        // IsPipeEmpty() is a utility function, not intended for general use
+        // Should only be used very prudently.
+        bool IsPipeEmpty() const;
+
+		void Clear();
+
+        uint32_t GetNumSegments() const
+        {
+            return m_NumSegments;
+        }
+
+    private:
+        struct Segment : PIPE
+        {
+            Segment() : pNext(NULL), pPrev(NULL) {}
+            Segment* volatile   pNext;
+            Segment*            pPrev; // only accessed by the writer
+        };
+
+        Segment* AddSegment();
+
+        // head segment is embedded so an array of chains allocates the first segment up front
+        Segment                         m_Head;
+        Segment*                        m_pTail;         // only accessed by the writer
+        Segment*                        m_pWriteSegment; // only accessed by the writer
+        uint32_t                        m_NumSegments;
+
+        // readers start from the last segment a read succeeded in, so a long chain of drained
+        // segments is not rescanned on every read. Races on this only cost a longer scan.
+        Segment* volatile               m_pReadHint;
+
+        LockLessPipeChain( const LockLessPipeChain& nocopy );
+        LockLessPipeChain& operator=( const LockLessPipeChain& nocopy );
+    };
+
+    template<typename PIPE, typename T> inline
+        LockLessPipeChain<PIPE,T>::LockLessPipeChain()
+        : m_pTail( &m_Head )
+        , m_pWriteSegment( &m_Head )
+        , m_NumSegments( 1 )
+        , m_pReadHint( &m_Head )
+    {
+    }
+
+    template<typename PIPE, typename T> inline
+        LockLessPipeChain<PIPE,T>::~LockLessPipeChain()
+    {
+        Segment* pSegment = m_Head.pNext;
+        while( pSegment )
+        {
+            Segment* pNext = pSegment->pNext;
+            delete pSegment;
+            pSegment = pNext;
+        }
+    }
+
+    template<typename PIPE, typename T> inline
+        typename LockLessPipeChain<PIPE,T>::Segment* LockLessPipeChain<PIPE,T>::AddSegment()
+    {
+        Segment* pSegment = new(std::nothrow) Segment;
+        if( pSegment )
+        {
+            pSegment->pPrev = m_pTail;
+
+            // segment must be fully constructed before readers can see it
+            AtomicStore( &m_pTail->pNext, pSegment, MEMORY_ORDER_RELEASE );
+            m_pTail = pSegment;
+            ++m_NumSegments;
+        }
+        return pSegment;
+    }
+
+    template<typename PIPE, typename T> inline
+        bool LockLessPipeChain<PIPE,T>::Reserve( uint32_t numSegments_ )
+    {
+        while( m_NumSegments < numSegments_ )
+        {
+            if( !AddSegment() )
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    template<typename PIPE, typename T> inline
+        bool LockLessPipeChain<PIPE,T>::ReaderTryReadBack(   T* pOut )
+    {
+        // scan from the hint to the tail, then wrap around to the head.
+        // Acquire pairs with the release in AddSegment, so new segments are constructed.
+        Segment* pStart   = AtomicLoad( &m_pReadHint, MEMORY_ORDER_ACQUIRE );
+        Segment* pSegment = pStart;
+        do
+        {
+            if( pSegment->ReaderTryReadBack( pOut ) )
+            {
+                if( pSegment != pStart )
+                {
+                    AtomicStore( &m_pReadHint, pSegment, MEMORY_ORDER_RELEASE );
+                }
+                return true;
+            }
+            Segment* pNext = AtomicLoad( &pSegment->pNext, MEMORY_ORDER_ACQUIRE );
+            pSegment = pNext ? pNext : &m_Head;
+        } while( pSegment != pStart );
+        return false;
+    }
+
+    template<typename PIPE, typename T> inline
+        bool LockLessPipeChain<PIPE,T>::WriterTryReadFront(  T* pOut )
+    {
+        // most recently written data is in the write segment, then in the segments before it
+        Segment* pSegment = m_pWriteSegment;
+        do
+        {
+            if( pSegment->WriterTryReadFront( pOut ) )
+            {
+                m_pWriteSegment = pSegment;
+                return true;
+            }
+            pSegment = pSegment->pPrev;
+        } while( pSegment );
+
+        // segments after the write segment can hold data if writes wrapped around the chain
+        pSegment = m_pWriteSegment->pNext;
+        while( pSegment )
+        {
+            if( pSegment->WriterTryReadFront( pOut ) )
+            {
+                m_pWriteSegment = pSegment;
+                return true;
+            }
+            pSegment = pSegment->pNext;
+        }
+        return false;
+    }
+
+    template<typename PIPE, typename T> inline
+        bool LockLessPipeChain<PIPE,T>::WriterTryWriteFront( const T& in )
+    {
+        if( m_pWriteSegment->WriterTryWriteFront( in ) )
+        {
+            return true;
+        }
+
+        // write segment full, so try the others in turn starting after it to reuse drained segments
+        Segment* pSegment = m_pWriteSegment->pNext ? m_pWriteSegment->pNext : &m_Head;
+        while( pSegment != m_pWriteSegment )
+        {
+            if( pSegment->WriterTryWriteFront( in ) )
+            {
+                m_pWriteSegment = pSegment;
+                return true;
+            }
+            pSegment = pSegment->pNext ? pSegment->pNext : &m_Head;
+        }
+
+        // all full, so grow
+        pSegment = AddSegment();
+        if( pSegment && pSegment->WriterTryWriteFront( in ) )
+        {
+            m_pWriteSegment = pSegment;
+            return true;
+        }
+        return false;
+    }
+
+    template<typename PIPE, typename T> inline
+        bool LockLessPipeChain<PIPE,T>::IsPipeEmpty() const
+    {
+        // start with the hint as that is where readers will find any data first
+        const Segment* pStart   = AtomicLoad( &m_pReadHint, MEMORY_ORDER_ACQUIRE );
+        const Segment* pSegment = pStart;
+        do
+        {
+            if( !pSegment->IsPipeEmpty() )
+            {
+                return false;
+            }
+            const Segment* pNext = AtomicLoad( &pSegment->pNext, MEMORY_ORDER_ACQUIRE );
+            pSegment = pNext ? pNext : &m_Head;
+        } while( pSegment != pStart );
+        return true;
+    }
+
+    template<typename PIPE, typename T> inline
+        void LockLessPipeChain<PIPE,T>::Clear()
+    {
+        Segment* pSegment = &m_Head;
+        do
+        {
+            pSegment->Clear();
+            pSegment = pSegment->pNext;
+        } while( pSegment );
+        m_pWriteSegment = &m_Head;
+        AtomicStore( &m_pReadHint, &m_Head, MEMORY_ORDER_RELAXED );
+    }
+
+}
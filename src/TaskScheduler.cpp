@@ -20,6 +20,10 @@
 
 #include "TaskScheduler.h"
 #include "LockLessMultiReadPipe.h"
+#include "LockLessChaseLevDeque.h"
+#include "LockLessPipeChain.h"
+#include "LockLessMultiWriteIntrusiveList.h"
+#include "Fibers.h"
 
 
 
@@ -27,261 +31,2018 @@ using namespace enki;
 
 
 static const uint32_t PIPESIZE_LOG2 = 8;
-static const uint32_t SPIN_COUNT = 100;
+static const uint32_t POOLED_TASK_SETS_PER_THREAD = 256; // default for TaskSchedulerConfig::pooledTaskSetsPerThread
+static const uint32_t FIBERS_PER_THREAD         = 16;   // default for TaskSchedulerConfig::fibersPerThread
+static const uint32_t FIBER_STACK_SIZE          = 256 * 1024; // default for TaskSchedulerConfig::fiberStackSize
+
+// Idle threads spin for an adaptive number of attempts before sleeping, see SpinPause and AdaptSpinLimit
+static const uint32_t SPIN_COUNT                = 100;  // initial spin limit
+static const uint32_t SPIN_COUNT_MIN            = 8;
+static const uint32_t SPIN_COUNT_MAX            = 2000;
+static const uint32_t SPIN_BACKOFF_LOG2_MAX     = 6;    // at most 64 pauses between attempts
+static const uint64_t SPIN_SHORT_SLEEP_NS       = 100000; // sleeps shorter than this were not worth it
+
+// Timer wheel for AddTimedTask, timers are hashed into slots by deadline tick, see ProcessTimedTasks
+static const uint32_t TIMER_WHEEL_SIZE_LOG2     = 8;
+static const uint32_t TIMER_WHEEL_SIZE          = 1 << TIMER_WHEEL_SIZE_LOG2;
+static const uint32_t TIMER_WHEEL_TICK_NS_LOG2  = 20;   // ticks of ~1ms
+static const uint64_t NO_DEADLINE               = ~(uint64_t)0;
+static const uint32_t NO_THREAD                 = ~(uint32_t)0;
+
+static const uint32_t DEADLINE_HEAP_CAPACITY    = 64;   // initial capacity, grows as needed, see AddDeadlineTaskSet
 
 // each software thread gets it's own copy of gtl_threadNum, so this is safe to use as a static variable
 static THREAD_LOCAL uint32_t                             gtl_threadNum       = 0;
 
-namespace enki 
+namespace enki 
+{
+	struct TaskSetInfo
+	{
+		ITaskSet*           pTask;
+		TaskSetPartition    partition;
+	};
+
+	// define ENKITS_TASK_PIPE_CHASE_LEV to use the Chase-Lev work stealing deque, which needs
+	// only one CAS per steal rather than the per slot flags of LockLessMultiReadPipe
+#ifdef ENKITS_TASK_PIPE_CHASE_LEV
+	typedef LockLessChaseLevDeque<PIPESIZE_LOG2,enki::TaskSetInfo> TaskPipeSegment;
+#else
+	typedef LockLessMultiReadPipe<PIPESIZE_LOG2,enki::TaskSetInfo> TaskPipeSegment;
+#endif
+
+	// we derive class TaskPipe rather than typedef to get forward declaration working easily
+	// pipes are a chain of segments which grows when full, see TaskSchedulerConfig::pipeCapacity
+	class TaskPipe : public LockLessPipeChain<TaskPipeSegment,enki::TaskSetInfo> {};
+
+	class PinnedTaskList : public LockLessMultiWriteIntrusiveList<IPinnedTask> {};
+
+	// timed tasks are added through a multiple writer list, and inserted into the timer wheel
+	// by the thread processing timers
+	class TimedTaskList : public LockLessMultiWriteIntrusiveList<TimedTask> {};
+
+	// task sets passed to a NUMA node to be divided up by one of its threads, see ITaskSet::m_PreferredNumaNode
+	class TaskSetList : public LockLessMultiWriteIntrusiveList<ITaskSet> {};
+
+	// entry in the binary min heap of task sets with deadlines, ordered by deadline then order
+	// added, with the keys copied so that sifting does not touch the task sets
+	struct DeadlineTaskSet
+	{
+		uint64_t                deadlineNS;
+		uint64_t                order;
+		ITaskSet*               pTaskSet;
+	};
+
+	static bool IsBefore( const DeadlineTaskSet& lhs_, const DeadlineTaskSet& rhs_ )
+	{
+		return lhs_.deadlineNS < rhs_.deadlineNS || ( lhs_.deadlineNS == rhs_.deadlineNS && lhs_.order < rhs_.order );
+	}
+
+	// slot in the pool used by AddTaskSetFireAndForget, the task set is constructed at the start
+	// of the slot so the slot can be found from the task set pointer
+	struct TaskPoolSlot
+	{
+		char                    taskSet[ TaskScheduler::POOLED_TASK_SET_MAX_SIZE ];
+		void                    (*pDestroy)( ITaskSet* );
+		TaskPoolSlot* volatile  pNext;
+	};
+
+	// slots freed by threads other than the owner are returned through a multiple writer list
+	class TaskPoolFreedList : public LockLessMultiWriteIntrusiveList<TaskPoolSlot> {};
+
+	// Fibers are only switched to on the thread which owns them. Each thread has its own context
+	// as fiber 0, followed by its pool. Free fibers are either new, or suspended at the top of
+	// the task loop in RunTasks, so switching to any free fiber continues running tasks.
+	struct Fiber
+	{
+		fiberid_t                   fiberid;
+		const ITaskSet* volatile    pWaitingForTaskSet; // set whilst parked, see TryParkFiber
+		uint32_t                    taskDepth;          // ExecuteRange calls in progress on this fiber
+		Fiber*                      pNextFree;
+	};
+
+	struct ThreadArgs
+	{
+		uint32_t		threadNum;
+		TaskScheduler*  pTaskScheduler;
+	};
+
+	enum ThreadState
+	{
+		THREAD_STATE_AWAKE,
+		THREAD_STATE_SLEEPING,
+	};
+
+	// per thread data, padded to prevent false sharing between threads, and between
+	// the data other threads access and the data only written by the owning thread
+	struct ThreadDataStore
+	{
+		semaphoreid_t           wakeSemaphore;
+		volatile uint32_t       threadState;
+		const ITaskSet* volatile pWaitingForTaskSet; // set whilst sleeping in WaitforTaskSet
+		const IPinnedTask* volatile pWaitingForPinnedTask; // set whilst sleeping in WaitforPinnedTask
+		volatile uint32_t       cacheGroup;         // see TaskSchedulerConfig::stealFromSharedCacheFirst
+		volatile uint32_t       numaNode;           // see TaskSchedulerConfig::numaAware
+		TaskPoolFreedList       pooledTaskSetsFreed;
+		Fiber*                  pFibers;            // see TaskSchedulerConfig::useFibers
+		volatile int32_t        numParkedFibers;
+		volatile uint32_t       bExternalThreadRegistered; // see RegisterExternalThread
+		char                    prevent_false_sharing[64];
+
+		// only written by the owning thread
+		uint32_t                spinLimit;
+		uint32_t                randomState;
+		TaskPoolSlot*           pPooledTaskSetsFree;
+		TaskSchedulerStats      stats;
+		Fiber*                  pCurrentFiber;
+		Fiber*                  pFreeFibers;
+		char                    prevent_false_sharing_owner[64];
+	};
+
+	// xorshift32 random number generator, state must not be 0
+	static uint32_t RandomNext( uint32_t& state_ )
+	{
+		uint32_t x = state_;
+		x ^= x << 13;
+		x ^= x >> 17;
+		x ^= x << 5;
+		state_ = x;
+		return x;
+	}
+
+	// Threads steal in passes: 0 from threads sharing the thief's last level cache,
+	// 1 from threads on its NUMA node, and 2 from the rest
+	static int GetStealPass( const ThreadDataStore& thief_, const ThreadDataStore& victim_, bool bCacheGroups_, bool bNumaNodes_ )
+	{
+		if( bCacheGroups_ && thief_.cacheGroup == AtomicLoad( &victim_.cacheGroup, MEMORY_ORDER_RELAXED ) )
+		{
+			return 0;
+		}
+		if( bNumaNodes_ && thief_.numaNode == AtomicLoad( &victim_.numaNode, MEMORY_ORDER_RELAXED ) )
+		{
+			return 1;
+		}
+		return 2;
+	}
+
+	// Reorders the cpus so that each physical core is used once before any of their SMT siblings
+	static void GetCPUsSpreadOverCores( uint32_t* pCPUs_, uint32_t numCPUs_ )
+	{
+		uint32_t* pSiblingIndex = new uint32_t[ numCPUs_ ];
+		uint32_t* pCore         = new uint32_t[ numCPUs_ ];
+		uint32_t* pCPUs         = new uint32_t[ numCPUs_ ];
+		uint32_t  maxSiblingIndex = 0;
+		for( uint32_t index = 0; index < numCPUs_; ++index )
+		{
+			pCPUs[ index ] = pCPUs_[ index ];
+			pCore[ index ] = GetCPUCore( pCPUs[ index ] );
+			pSiblingIndex[ index ] = 0;
+			for( uint32_t lowerIndex = 0; lowerIndex < index; ++lowerIndex )
+			{
+				if( pCore[ lowerIndex ] == pCore[ index ] )
+				{
+					++pSiblingIndex[ index ];
+				}
+			}
+			if( pSiblingIndex[ index ] > maxSiblingIndex )
+			{
+				maxSiblingIndex = pSiblingIndex[ index ];
+			}
+		}
+		uint32_t numOrdered = 0;
+		for( uint32_t siblingIndex = 0; siblingIndex <= maxSiblingIndex; ++siblingIndex )
+		{
+			for( uint32_t index = 0; index < numCPUs_; ++index )
+			{
+				if( siblingIndex == pSiblingIndex[ index ] )
+				{
+					pCPUs_[ numOrdered++ ] = pCPUs[ index ];
+				}
+			}
+		}
+		delete[] pCPUs;
+		delete[] pCore;
+		delete[] pSiblingIndex;
+	}
+
+	// Pause between attempts to find work, backing off exponentially to reduce
+	// contention on the pipes and free execution resources for a hyperthread sibling.
+	static void SpinPause( uint32_t spinCount )
+	{
+		uint32_t numPauses = 1u << ( spinCount < SPIN_BACKOFF_LOG2_MAX ? spinCount : SPIN_BACKOFF_LOG2_MAX );
+		for( uint32_t pause = 0; pause < numPauses; ++pause )
+		{
+			BASE_CPU_PAUSE();
+		}
+	}
+
+	// Spin lock for short critical sections which do not call out of the scheduler.
+	// Backs off, then yields so that a preempted holder can run when threads outnumber cores.
+	static void SpinLock( volatile uint32_t& lock_ )
+	{
+		uint32_t spinCount = 0;
+		while( AtomicLoad( &lock_, MEMORY_ORDER_RELAXED ) || 0 != AtomicCompareAndSwap( &lock_, 1, 0, MEMORY_ORDER_ACQUIRE ) )
+		{
+			if( spinCount < SPIN_BACKOFF_LOG2_MAX )
+			{
+				SpinPause( spinCount++ );
+			}
+			else
+			{
+				ThreadYield();
+			}
+		}
+	}
+
+	static void SpinUnlock( volatile uint32_t& lock_ )
+	{
+		AtomicStore( &lock_, 0, MEMORY_ORDER_RELEASE );
+	}
+
+	// Work found after spinCount failed attempts, so ensure the limit covers twice this.
+	static void AdaptSpinLimit( ThreadDataStore& threadData, uint32_t spinCount )
+	{
+		uint32_t spinLimit = 2 * spinCount;
+		if( spinLimit > SPIN_COUNT_MAX ) { spinLimit = SPIN_COUNT_MAX; }
+		if( spinLimit > threadData.spinLimit )
+		{
+			threadData.spinLimit = spinLimit;
+		}
+	}
+
+	// After a sleep, spin for longer if work arrived soon after we slept, so bursty work
+	// avoids the cost of sleeping and waking. Long sleeps mean the spinning was wasted.
+	static void AdaptSpinLimitAfterSleep( ThreadDataStore& threadData, uint64_t sleepTimeNS )
+	{
+		if( sleepTimeNS < SPIN_SHORT_SLEEP_NS )
+		{
+			threadData.spinLimit = 2 * threadData.spinLimit < SPIN_COUNT_MAX ? 2 * threadData.spinLimit : SPIN_COUNT_MAX;
+		}
+		else
+		{
+			threadData.spinLimit = threadData.spinLimit / 2 > SPIN_COUNT_MIN ? threadData.spinLimit / 2 : SPIN_COUNT_MIN;
+		}
+	}
+}
+
+
+Dependency::Dependency()
+	: pDependencyTask(NULL)
+	, pTaskToRunOnCompletion(NULL)
+	, pNext(NULL)
+{
+}
+
+Dependency::Dependency( ITaskSet* pDependencyTask_, ITaskSet* pTaskToRunOnCompletion_ )
+	: pDependencyTask(NULL)
+	, pTaskToRunOnCompletion(NULL)
+	, pNext(NULL)
+{
+	pTaskToRunOnCompletion_->SetDependency( *this, pDependencyTask_ );
+}
+
+Dependency::~Dependency()
+{
+	if( pTaskToRunOnCompletion )
+	{
+		pTaskToRunOnCompletion->ClearDependency( *this );
+	}
+}
+
+void ITaskSet::SetDependency( Dependency& dependency_, ITaskSet* pDependencyTask_ )
+{
+	assert( pDependencyTask_ != this );
+	if( dependency_.pTaskToRunOnCompletion )
+	{
+		dependency_.pTaskToRunOnCompletion->ClearDependency( dependency_ );
+	}
+	dependency_.pDependencyTask         = pDependencyTask_;
+	dependency_.pTaskToRunOnCompletion  = this;
+	dependency_.pNext                   = pDependencyTask_->m_pDependents;
+	pDependencyTask_->m_pDependents     = &dependency_;
+	++m_DependenciesCount;
+}
+
+void ITaskSet::ClearDependency( Dependency& dependency_ )
+{
+	assert( dependency_.pTaskToRunOnCompletion == this );
+	Dependency** ppDependent = &dependency_.pDependencyTask->m_pDependents;
+	while( *ppDependent )
+	{
+		if( *ppDependent == &dependency_ )
+		{
+			*ppDependent = dependency_.pNext;
+			break;
+		}
+		ppDependent = &(*ppDependent)->pNext;
+	}
+	dependency_.pDependencyTask         = NULL;
+	dependency_.pTaskToRunOnCompletion  = NULL;
+	dependency_.pNext                   = NULL;
+	--m_DependenciesCount;
+}
+
+
+THREADFUNC_DECL TaskScheduler::TaskingThreadFunction( void* pArgs )
+{
+	ThreadArgs args					= *(ThreadArgs*)pArgs;
+	uint32_t threadNum				= args.threadNum;
+	TaskScheduler*  pTS				= args.pTaskScheduler;
+    gtl_threadNum      = threadNum;
+	pTS->UpdateCacheGroup( threadNum );
+	AtomicAdd( &pTS->m_NumThreadsActive, 1 );
+
+    ThreadDataStore& threadData = pTS->m_pThreadDataStore[ threadNum ];
+    if( pTS->m_Config.numaAware )
+    {
+        // allocate from this thread so first touch places the memory on our node,
+        // then wait for the other threads as we may steal from any of their pipes
+        pTS->AllocateThreadMemory( threadNum );
+        AtomicAdd( &pTS->m_pNumThreadsPerNumaNode[ threadData.numaNode ], 1 );
+        AtomicAdd( &pTS->m_NumThreadsStarting, -1 );
+        uint32_t spinCount = 0;
+        while( AtomicLoad( &pTS->m_NumThreadsStarting, MEMORY_ORDER_ACQUIRE ) )
+        {
+            SpinPause( ++spinCount );
+        }
+    }
+
+    if( threadData.pFibers )
+    {
+        // run tasks on a pool fiber, which switches back here when the scheduler stops
+        FiberConvertThread( threadData.pFibers[0].fiberid );
+        threadData.pCurrentFiber = &threadData.pFibers[0];
+        Fiber* pFiber = threadData.pFreeFibers;
+        threadData.pFreeFibers = pFiber->pNextFree;
+        pTS->SwitchFiber( threadNum, pFiber );
+        FiberConvertBackToThread( threadData.pFibers[0].fiberid );
+    }
+    else
+    {
+        pTS->RunTasks( threadNum );
+    }
+
+    AtomicAdd( &pTS->m_NumThreadsRunning, -1 );
+    return 0;
+}
+
+void TaskScheduler::FiberFunction( void* pArgs )
+{
+	ThreadArgs args					= *(ThreadArgs*)pArgs;
+	uint32_t threadNum				= args.threadNum;
+	TaskScheduler*  pTS				= args.pTaskScheduler;
+    pTS->RunTasks( threadNum );
+
+    // fibers must not return, so switch back to the thread's own context to exit
+    pTS->SwitchFiber( threadNum, &pTS->m_pThreadDataStore[ threadNum ].pFibers[0] );
+}
+
+void TaskScheduler::RunTasks( uint32_t threadNum )
+{
+    ThreadDataStore& threadData = m_pThreadDataStore[ threadNum ];
+    uint32_t spinCount = 0;
+    while( AtomicLoad( &m_bRunning, MEMORY_ORDER_RELAXED ) )
+    {
+        if( AtomicLoad( &threadData.numParkedFibers, MEMORY_ORDER_RELAXED ) && TryResumeParkedFiber( threadNum ) )
+        {
+            // we were put on the free list and have been switched back to
+            spinCount = 0;
+            continue;
+        }
+        if( threadNum >= AtomicLoad( &m_NumActiveThreads, MEMORY_ORDER_RELAXED ) )
+        {
+            WaitWhileParked( threadNum );
+            spinCount = 0;
+            continue;
+        }
+        RunPinnedTasks( threadNum );
+        if( TryRunTask( threadNum ) )
+        {
+            if( spinCount )
+            {
+                AdaptSpinLimit( threadData, spinCount );
+                spinCount = 0;
+            }
+        }
+        else
+        {
+            // no tasks, will spin then wait. WaitForNewTasks checks for tasks before sleeping.
+            ++spinCount;
+            if( spinCount > threadData.spinLimit )
+            {
+                WaitForNewTasks( threadNum );
+                spinCount = 0;
+            }
+            else
+            {
+                SpinPause( spinCount );
+            }
+        }
+    }
+}
+
+void TaskScheduler::WaitWhileParked( uint32_t threadNum )
+{
+    // Parked threads only run work which must run on this thread, or which would otherwise not be
+    // found as parked threads sleep without becoming the timer thread. Queued partitions in our pipes
+    // are stolen by the active threads.
+    RunPinnedTasks( threadNum );
+    if( AtomicLoad( &m_NumTimedTasks, MEMORY_ORDER_RELAXED ) &&
+        GetTimeNS() >= AtomicLoad( &m_TimedTaskNextDeadlineNS, MEMORY_ORDER_RELAXED ) )
+    {
+        ProcessTimedTasks();
+    }
+    if( AtomicLoad( &m_NumNumaInboxTaskSets, MEMORY_ORDER_RELAXED ) )
+    {
+        // our node's inbox may have been sent to us before we were parked
+        TryAddNumaTaskSets( threadNum );
+    }
+
+    // same sleep protocol as SleepThread, but without the timer thread role
+    ThreadDataStore& threadData = m_pThreadDataStore[ threadNum ];
+    AtomicAdd( &m_NumThreadsActive, -1 );
+    AtomicStore( &threadData.threadState, THREAD_STATE_SLEEPING, MEMORY_ORDER_RELAXED );
+
+    // full barrier: either SetNumActiveThreads or a thread adding work for us sees us sleeping, or we see it
+    AtomicAdd( &m_NumThreadsSleeping, 1 );
+    bool bWait = true;
+    if( !AtomicLoad( &m_bRunning ) || threadNum < AtomicLoad( &m_NumActiveThreads ) || HaveParkedThreadWork( threadNum ) )
+    {
+        bWait = THREAD_STATE_SLEEPING != AtomicCompareAndSwap( &threadData.threadState, THREAD_STATE_AWAKE, THREAD_STATE_SLEEPING );
+    }
+    if( bWait )
+    {
+        SemaphoreWait( threadData.wakeSemaphore );
+    }
+    AtomicAdd( &m_NumThreadsSleeping, -1 );
+    AtomicAdd( &m_NumThreadsActive, 1 );
+    UpdateCacheGroup( threadNum );
+}
+
+bool TaskScheduler::HaveParkedThreadWork( uint32_t threadNum ) const
+{
+    if( !m_pPinnedTaskListPerThread[ threadNum ].IsListEmpty() )
+    {
+        return true;
+    }
+    if( m_pFibers && GetReadyParkedFiber( threadNum ) )
+    {
+        return true;
+    }
+    if( AtomicLoad( &m_NumNumaInboxTaskSets ) &&
+        !m_pTaskSetInboxPerNumaNode[ m_pThreadDataStore[ threadNum ].numaNode ].IsListEmpty() )
+    {
+        return true;
+    }
+    return false;
+}
+
+void TaskScheduler::SwitchFiber( uint32_t threadNum, Fiber* pFiber )
+{
+    ThreadDataStore& threadData = m_pThreadDataStore[ threadNum ];
+    Fiber* pCurrentFiber = threadData.pCurrentFiber;
+    threadData.pCurrentFiber = pFiber;
+    FiberSwitch( pCurrentFiber->fiberid, pFiber->fiberid );
+}
+
+Fiber* TaskScheduler::GetReadyParkedFiber( uint32_t threadNum ) const
+{
+    const ThreadDataStore& threadData = m_pThreadDataStore[ threadNum ];
+    if( !AtomicLoad( &threadData.numParkedFibers, MEMORY_ORDER_RELAXED ) )
+    {
+        return NULL;
+    }
+    for( uint32_t fiber = 1; fiber <= m_Config.fibersPerThread; ++fiber )
+    {
+        const ITaskSet* pWaitingForTaskSet = AtomicLoad( &threadData.pFibers[ fiber ].pWaitingForTaskSet, MEMORY_ORDER_RELAXED );
+        if( pWaitingForTaskSet && 0 == AtomicLoad( &pWaitingForTaskSet->m_CompletionCount, MEMORY_ORDER_ACQUIRE ) )
+        {
+            return &threadData.pFibers[ fiber ];
+        }
+    }
+    return NULL;
+}
+
+bool TaskScheduler::TryParkFiber( uint32_t threadNum, const ITaskSet* pTaskSet )
+{
+    // Only fibers running a task park, as the thread's own context and fibers at the top of
+    // RunTasks have nothing to return to. Switch to a parked fiber which is ready to resume
+    // if there is one, as it may be running a partition of the task set we are waiting for.
+    ThreadDataStore& threadData = m_pThreadDataStore[ threadNum ];
+    Fiber* pFiber = threadData.pCurrentFiber;
+    if( !pFiber || !pFiber->taskDepth )
+    {
+        return false;
+    }
+    Fiber* pNextFiber = GetReadyParkedFiber( threadNum );
+    if( !pNextFiber )
+    {
+        pNextFiber = threadData.pFreeFibers;
+        if( !pNextFiber )
+        {
+            return false;
+        }
+        threadData.pFreeFibers = pNextFiber->pNextFree;
+    }
+
+    AtomicStore( &pFiber->pWaitingForTaskSet, pTaskSet, MEMORY_ORDER_RELAXED );
+    AtomicAdd( &threadData.numParkedFibers, 1 );
+
+    // full barrier: either PartitionComplete sees a parked fiber, or we see the task set complete
+    AtomicAdd( &m_NumParkedFibers, 1 );
+    if( AtomicLoad( &pTaskSet->m_CompletionCount ) )
+    {
+        SwitchFiber( threadNum, pNextFiber );
+    }
+    else if( !AtomicLoad( &pNextFiber->pWaitingForTaskSet, MEMORY_ORDER_RELAXED ) )
+    {
+        // completed whilst parking, so return the unused fiber
+        pNextFiber->pNextFree = threadData.pFreeFibers;
+        threadData.pFreeFibers = pNextFiber;
+    }
+
+    // resumed on this thread by TryResumeParkedFiber or TryParkFiber
+    AtomicStore( &pFiber->pWaitingForTaskSet, NULL, MEMORY_ORDER_RELAXED );
+    AtomicAdd( &threadData.numParkedFibers, -1 );
+    AtomicAdd( &m_NumParkedFibers, -1 );
+    return true;
+}
+
+bool TaskScheduler::TryResumeParkedFiber( uint32_t threadNum )
+{
+    // called at the top of RunTasks, so the current fiber can be freed and later
+    // switched to again to carry on running tasks
+    Fiber* pReadyFiber = GetReadyParkedFiber( threadNum );
+    if( !pReadyFiber )
+    {
+        return false;
+    }
+    ThreadDataStore& threadData = m_pThreadDataStore[ threadNum ];
+    Fiber* pFiber = threadData.pCurrentFiber;
+    pFiber->pNextFree = threadData.pFreeFibers;
+    threadData.pFreeFibers = pFiber;
+    SwitchFiber( threadNum, pReadyFiber );
+    return true;
+}
+
+
+void TaskScheduler::StartThreads()
+{
+    if( m_bHaveThreads )
+    {
+        return;
+    }
+    AtomicStore( &m_bRunning, true, MEMORY_ORDER_RELAXED );
+
+    // the calling thread is thread 0, identified by the address of its thread local
+    // as gtl_threadNum is also 0 on threads which are not registered
+    m_pThread0ThreadNum = &gtl_threadNum;
+
+    if( m_Config.stealFromSharedCacheFirst )
+    {
+        // reading the cache topology is slow, so do it once for all cpus
+        m_NumCPUs = GetNumHardwareThreads();
+        m_pCacheGroupPerCPU = new uint32_t[m_NumCPUs];
+        for( uint32_t cpu = 0; cpu < m_NumCPUs; ++cpu )
+        {
+            m_pCacheGroupPerCPU[cpu] = GetCPUCacheGroup( cpu );
+        }
+    }
+    if( m_Config.numaAware )
+    {
+        m_NumCPUs = GetNumHardwareThreads();
+        m_pNumaNodePerCPU = new uint32_t[m_NumCPUs];
+        m_NumNumaNodes = 1;
+        for( uint32_t cpu = 0; cpu < m_NumCPUs; ++cpu )
+        {
+            m_pNumaNodePerCPU[cpu] = GetCPUNumaNode( cpu );
+            if( m_pNumaNodePerCPU[cpu] >= m_NumNumaNodes )
+            {
+                m_NumNumaNodes = m_pNumaNodePerCPU[cpu] + 1;
+            }
+        }
+        m_pNumThreadsPerNumaNode = new int32_t[m_NumNumaNodes];
+        for( uint32_t node = 0; node < m_NumNumaNodes; ++node )
+        {
+            m_pNumThreadsPerNumaNode[node] = 0;
+        }
+        m_pTaskSetInboxPerNumaNode = new TaskSetList[m_NumNumaNodes];
+        m_NumNumaInboxTaskSets = 0;
+    }
+
+    // pool for AddTaskSetFireAndForget, aligned so slots do not share cache lines
+    uint32_t numPooledTaskSets = m_NumThreads * m_Config.pooledTaskSetsPerThread;
+    m_pTaskPoolMemory = new char[ numPooledTaskSets * sizeof( TaskPoolSlot ) + 63 ];
+    m_pTaskPool = (TaskPoolSlot*)( ( (uintptr_t)m_pTaskPoolMemory + 63 ) & ~(uintptr_t)63 );
+
+    m_pThreadDataStore = new ThreadDataStore[m_NumThreads];
+    for( uint32_t thread = 0; thread < m_NumThreads; ++thread )
+    {
+        SemaphoreCreate( m_pThreadDataStore[thread].wakeSemaphore );
+        m_pThreadDataStore[thread].threadState = THREAD_STATE_AWAKE;
+        m_pThreadDataStore[thread].pWaitingForTaskSet = NULL;
+        m_pThreadDataStore[thread].pWaitingForPinnedTask = NULL;
+        m_pThreadDataStore[thread].cacheGroup = 0;
+        m_pThreadDataStore[thread].numaNode = 0;
+        m_pThreadDataStore[thread].spinLimit = SPIN_COUNT;
+        m_pThreadDataStore[thread].randomState = 0x9E3779B9u * ( thread + 1 ); // any non zero seed
+        m_pThreadDataStore[thread].pFibers = NULL;
+        m_pThreadDataStore[thread].numParkedFibers = 0;
+        m_pThreadDataStore[thread].pCurrentFiber = NULL;
+        m_pThreadDataStore[thread].pFreeFibers = NULL;
+        m_pThreadDataStore[thread].bExternalThreadRegistered = 0;
+    }
+    m_NumExternalThreadsRegistered = 0;
+    UpdateCacheGroup( 0 );
+
+    // with numaAware task threads allocate their own memory when they start
+    uint32_t numThreads = m_Config.numThreads;
+    for( uint32_t thread = 0; thread < m_NumThreads; ++thread )
+    {
+        if( !m_Config.numaAware || 0 == thread || thread >= numThreads )
+        {
+            AllocateThreadMemory( thread );
+        }
+    }
+
+    m_pTimedTaskInbox = new TimedTaskList;
+    m_pTimerWheel = new TimedTask*[ TIMER_WHEEL_SIZE ];
+    for( uint32_t slot = 0; slot < TIMER_WHEEL_SIZE; ++slot )
+    {
+        m_pTimerWheel[ slot ] = NULL;
+    }
+    m_TimerWheelTick = ( GetTimeNS() >> TIMER_WHEEL_TICK_NS_LOG2 ) - 1;
+    m_TimedTaskNextDeadlineNS = NO_DEADLINE;
+    m_TimerSleepThread = NO_THREAD;
+
+    m_pDeadlineHeap = new DeadlineTaskSet[ DEADLINE_HEAP_CAPACITY ];
+    m_DeadlineHeapCapacity = DEADLINE_HEAP_CAPACITY;
+
+    // we create one less thread than numThreads as the main thread counts as one,
+    // and none for the external thread slots which follow
+    m_pThreadNumStore = new ThreadArgs[numThreads];
+    m_pThreadIDs      = new threadid_t[numThreads];
+	m_pThreadNumStore[0].threadNum      = 0;
+	m_pThreadNumStore[0].pTaskScheduler = this;
+	m_pThreadIDs[0] = 0;
+    for( uint32_t thread = 1; thread < numThreads; ++thread )
+    {
+		m_pThreadNumStore[thread].threadNum      = thread;
+		m_pThreadNumStore[thread].pTaskScheduler = this;
+    }
+
+    if( m_Config.useFibers && numThreads > 1 )
+    {
+        // each task thread has its own context followed by its pool, thread 0 and external threads have none
+        uint32_t fibersPerThread = m_Config.fibersPerThread + 1;
+        m_pFibers = new Fiber[ ( numThreads - 1 ) * fibersPerThread ];
+        for( uint32_t thread = 1; thread < numThreads; ++thread )
+        {
+            Fiber* pFibers = m_pFibers + ( thread - 1 ) * fibersPerThread;
+            for( uint32_t fiber = 0; fiber < fibersPerThread; ++fiber )
+            {
+                pFibers[fiber].pWaitingForTaskSet = NULL;
+                pFibers[fiber].taskDepth = 0;
+                pFibers[fiber].pNextFree = fiber + 1 < fibersPerThread ? &pFibers[fiber + 1] : NULL;
+                if( fiber )
+                {
+                    FiberCreate( pFibers[fiber].fiberid, m_Config.fiberStackSize, FiberFunction, &m_pThreadNumStore[thread] );
+                }
+            }
+            m_pThreadDataStore[thread].pFibers = pFibers;
+            m_pThreadDataStore[thread].pFreeFibers = &pFibers[1];
+        }
+    }
+
+    uint32_t  numThreadCPUs = 0;
+    uint32_t* pThreadCPUs   = NULL;
+    if( m_Config.pinThreadsToCPUs )
+    {
+        if( m_Config.pThreadCPUs )
+        {
+            numThreadCPUs = m_Config.numThreadCPUs;
+            pThreadCPUs = new uint32_t[ numThreadCPUs ];
+            for( uint32_t cpu = 0; cpu < numThreadCPUs; ++cpu )
+            {
+                pThreadCPUs[ cpu ] = m_Config.pThreadCPUs[ cpu ];
+            }
+        }
+        else
+        {
+            // only CPUs in the affinity mask can be used, which under taskset or in a container
+            // may be any subset of the machine's CPUs
+            numThreadCPUs = GetAffinityCPUs( NULL, 0 );
+            pThreadCPUs = new uint32_t[ numThreadCPUs ];
+            GetAffinityCPUs( pThreadCPUs, numThreadCPUs );
+            GetCPUsSpreadOverCores( pThreadCPUs, numThreadCPUs );
+        }
+    }
+
+    // threads read these as soon as they start
+    AtomicStore( &m_NumActiveThreads, numThreads, MEMORY_ORDER_RELAXED );
+    SetNumPartitions( numThreads );
+
+    m_NumThreadsStarting = m_Config.numaAware ? (int32_t)numThreads - 1 : 0;
+    m_NumPinnedThreads = 0;
+    for( uint32_t thread = 1; thread < numThreads; ++thread )
+    {
+        int32_t cpu = numThreadCPUs ? (int32_t)pThreadCPUs[ ( thread - 1 ) % numThreadCPUs ] : -1;
+        bool bPinned = false;
+        AtomicAdd( &m_NumThreadsRunning, 1, MEMORY_ORDER_RELAXED );
+        ThreadCreate( &m_pThreadIDs[thread], TaskingThreadFunction, &m_pThreadNumStore[thread], cpu, &bPinned );
+        if( bPinned )
+        {
+            ++m_NumPinnedThreads;
+        }
+    #if defined( _WIN32 ) || defined( __linux__ )
+        // the thread runs unpinned if its cpu cannot be used, such as one outside the affinity mask
+        assert( bPinned || cpu < 0 );
+    #endif
+    }
+    delete[] pThreadCPUs;
+
+    // wait for task threads to allocate their pipes, see TaskingThreadFunction
+    uint32_t spinCount = 0;
+    while( AtomicLoad( &m_NumThreadsStarting, MEMORY_ORDER_ACQUIRE ) )
+    {
+        SpinPause( ++spinCount );
+    }
+
+    m_bHaveThreads = true;
+}
+
+void TaskScheduler::SetNumPartitions( uint32_t numActiveThreads )
+{
+    // ensure we have sufficient tasks to equally fill either all threads including main
+    // or just the threads we've launched, this is outside the firstinit as we want to be able
+    // to runtime change it
+	if( 1 == numActiveThreads )
+	{
+		AtomicStore( &m_NumPartitions, 1, MEMORY_ORDER_RELAXED );
+	}
+	else
+	{
+		AtomicStore( &m_NumPartitions, numActiveThreads * (numActiveThreads - 1), MEMORY_ORDER_RELAXED );
+	}
+}
+
+void TaskScheduler::StopThreads( bool bWait_ )
+{
+    if( m_bHaveThreads )
+    {
+        // wait for them threads quit before deleting data, parked threads are woken as well
+        AtomicStore( &m_NumActiveThreads, m_Config.numThreads );
+        AtomicStore( &m_bRunning, false );
+        while( bWait_ && AtomicLoad( &m_NumThreadsRunning, MEMORY_ORDER_ACQUIRE ) )
+        {
+            // keep waking threads to ensure all threads pick up state of m_bRunning
+            WakeThreads( m_NumThreads );
+        }
+
+        for( uint32_t thread = 1; thread < m_Config.numThreads; ++thread )
+        {
+            ThreadTerminate( m_pThreadIDs[thread] );
+        }
+
+        if( m_pFibers )
+        {
+            for( uint32_t thread = 1; thread < m_Config.numThreads; ++thread )
+            {
+                for( uint32_t fiber = 1; fiber <= m_Config.fibersPerThread; ++fiber )
+                {
+                    FiberDelete( m_pThreadDataStore[thread].pFibers[fiber].fiberid );
+                }
+            }
+            delete[] m_pFibers;
+            m_pFibers = NULL;
+        }
+
+        // timed tasks not yet run are dropped
+        ClearTimedTasks();
+        delete m_pTimedTaskInbox;
+        m_pTimedTaskInbox = 0;
+        delete[] m_pTimerWheel;
+        m_pTimerWheel = 0;
+
+        // as are task sets with deadlines not yet run
+        delete[] m_pDeadlineHeap;
+        m_pDeadlineHeap = 0;
+        m_DeadlineHeapSize = 0;
+        m_DeadlineHeapCapacity = 0;
+
+        delete[] m_pThreadNumStore;
+        delete[] m_pThreadIDs;
+        m_pThreadNumStore = 0;
+        m_pThreadIDs = 0;
+        for( uint32_t thread = 0; thread < m_NumThreads; ++thread )
+        {
+            SemaphoreClose( m_pThreadDataStore[thread].wakeSemaphore );
+        }
+        delete[] m_pThreadDataStore;
+        m_pThreadDataStore = 0;
+        delete[] m_pCacheGroupPerCPU;
+        m_pCacheGroupPerCPU = 0;
+        delete[] m_pNumaNodePerCPU;
+        m_pNumaNodePerCPU = 0;
+        delete[] m_pNumThreadsPerNumaNode;
+        m_pNumThreadsPerNumaNode = 0;
+        delete[] m_pTaskSetInboxPerNumaNode;
+        m_pTaskSetInboxPerNumaNode = 0;
+        m_NumNumaNodes = 0;
+        delete[] m_pTaskPoolMemory;
+        m_pTaskPoolMemory = 0;
+        m_pTaskPool = 0;
+        m_NumCPUs = 0;
+		m_NumThreads = 0;
+
+        m_bHaveThreads = false;
+		m_NumThreadsActive = 0;
+		m_NumThreadsRunning = 0;
+		m_NumPinnedThreads = 0;
+    }
+}
+
+bool TaskScheduler::TryRunTask( uint32_t threadNum )
+{
+    ThreadDataStore& threadData = m_pThreadDataStore[ threadNum ];
+
+    if( AtomicLoad( &m_NumTimedTasks, MEMORY_ORDER_RELAXED ) &&
+        GetTimeNS() >= AtomicLoad( &m_TimedTaskNextDeadlineNS, MEMORY_ORDER_RELAXED ) )
+    {
+        ProcessTimedTasks();
+    }
+
+    // task sets with deadlines run first, the shared queue is only checked when it is not empty
+    if( AtomicLoad( &m_NumDeadlineTaskSets, MEMORY_ORDER_RELAXED ) && TryRunDeadlineTask( threadNum ) )
+    {
+        return true;
+    }
+
+    // steal starting from a random thread, so thieves do not all contend on the low numbered threads
+    uint32_t startThread = (uint32_t)( ( (uint64_t)RandomNext( threadData.randomState ) * m_NumThreads ) >> 32 );
+
+    // task sets passed to our NUMA node are divided into our pipe
+    if( AtomicLoad( &m_NumNumaInboxTaskSets, MEMORY_ORDER_RELAXED ) )
+    {
+        TryAddNumaTaskSets( threadNum );
+    }
+
+    // check for tasks, in priority order across our own pipe and other threads
+    TaskSetInfo info;
+    bool bNumaNodes = m_NumNumaNodes > 1;
+    int firstPass = m_Config.stealFromSharedCacheFirst ? 0 : ( bNumaNodes ? 1 : 2 );
+    bool bHaveTask = false;
+    for( int priority = 0; !bHaveTask && priority < TASK_PRIORITY_NUM; ++priority )
+    {
+        bHaveTask = m_pPipesPerThread[ threadNum ][ priority ].WriterTryReadFront( &info );
+
+        // see GetStealPass, when all threads are in the same pass only the last pass is run
+        for( int pass = firstPass; !bHaveTask && pass < 3; ++pass )
+        {
+            for( uint32_t offset = 0; !bHaveTask && offset < m_NumThreads; ++offset )
+            {
+                uint32_t checkOtherThread = startThread + offset;
+                if( checkOtherThread >= m_NumThreads )
+                {
+                    checkOtherThread -= m_NumThreads;
+                }
+                if( checkOtherThread == threadNum )
+                {
+                    continue;
+                }
+                if( firstPass < 2 && pass != GetStealPass( threadData, m_pThreadDataStore[ checkOtherThread ],
+                                                           m_Config.stealFromSharedCacheFirst, bNumaNodes ) )
+                {
+                    continue;
+                }
+
+                TaskPipe& pipe = m_pPipesPerThread[ checkOtherThread ][ priority ];
+                if( !pipe.IsPipeEmpty() )
+                {
+                    ++threadData.stats.numStealAttempts;
+                    bHaveTask = pipe.ReaderTryReadBack( &info );
+                    if( bHaveTask )
+                    {
+                        ++threadData.stats.numSteals;
+                    }
+                }
+            }
+        }
+    }
+
+    if( bHaveTask )
+    {
+        ++threadData.stats.numPartitionsRun;
+        if( TASK_PARTITION_MODE_LAZY_SPLIT == m_Config.partitionMode )
+        {
+            SplitAndExecuteRange( info.pTask, info.partition, threadNum );
+        }
+        else
+        {
+            // the task has already been divided up by AddTaskSetToPipe, so just run it
+            ExecuteRange( info.pTask, info.partition, threadNum );
+        }
+        PartitionComplete( info.pTask );
+    }
+
+    return bHaveTask;
+
+}
+
+bool TaskScheduler::TryRunDeadlineTask( uint32_t threadNum )
+{
+    // Take a range of the task set with the earliest deadline. Like the lazy partition mode,
+    // the range is the remainder divided between the threads running tasks, so the lock is taken
+    // a few times per thread rather than once per partition, whilst the last ranges are still shared.
+    uint32_t numRunningThreads = AtomicLoad( &m_NumActiveThreads, MEMORY_ORDER_RELAXED ) +
+                                 (uint32_t)AtomicLoad( &m_NumExternalThreadsRegistered, MEMORY_ORDER_RELAXED );
+    SpinLock( m_DeadlineTaskSetsLock );
+    if( !m_DeadlineHeapSize )
+    {
+        SpinUnlock( m_DeadlineTaskSetsLock );
+        return false;
+    }
+    ITaskSet* pTaskSet = m_pDeadlineHeap[0].pTaskSet;
+    uint32_t partitionSize = GetPartitionSize( pTaskSet );
+    TaskSetPartition range;
+    range.start = pTaskSet->m_DeadlineRangeStart;
+    range.end   = pTaskSet->m_SetSize;
+    uint32_t numPartitionsLeft = ( range.end - range.start - 1 ) / partitionSize + 1;
+    uint32_t numPartitions = ( numPartitionsLeft - 1 ) / numRunningThreads + 1;
+    if( numPartitions < numPartitionsLeft )
+    {
+        range.end = range.start + numPartitions * partitionSize;
+    }
+    pTaskSet->m_DeadlineRangeStart = range.end;
+    bool bLastRange = range.end == pTaskSet->m_SetSize;
+    if( bLastRange )
+    {
+        PopDeadlineTaskSet();
+    }
+    AtomicAdd( &pTaskSet->m_CompletionCount, +1 );
+    SpinUnlock( m_DeadlineTaskSetsLock );
+
+    if( bLastRange )
+    {
+        // release the count AddTaskSetToPipe held whilst the task set was queued,
+        // our range's count keeps it from completing
+        AtomicAdd( &m_NumDeadlineTaskSets, -1 );
+        PartitionComplete( pTaskSet );
+    }
+
+    // run the range a partition at a time, so cancellation and auto partitioning work as for other task sets
+    TaskSetPartition partition;
+    partition.start = range.start;
+    while( partition.start < range.end )
+    {
+        partition.end = range.end - partition.start > partitionSize ? partition.start + partitionSize : range.end;
+        ++m_pThreadDataStore[ threadNum ].stats.numPartitionsRun;
+        ExecuteRange( pTaskSet, partition, threadNum );
+        partition.start = partition.end;
+    }
+    PartitionComplete( pTaskSet );
+    return true;
+}
+
+void TaskScheduler::PopDeadlineTaskSet()
+{
+    // called with m_DeadlineTaskSetsLock held, moves the last entry down from the root
+    DeadlineTaskSet last = m_pDeadlineHeap[ --m_DeadlineHeapSize ];
+    uint32_t index = 0;
+    uint32_t child = 1;
+    while( child < m_DeadlineHeapSize )
+    {
+        if( child + 1 < m_DeadlineHeapSize && IsBefore( m_pDeadlineHeap[ child + 1 ], m_pDeadlineHeap[ child ] ) )
+        {
+            ++child;
+        }
+        if( !IsBefore( m_pDeadlineHeap[ child ], last ) )
+        {
+            break;
+        }
+        m_pDeadlineHeap[ index ] = m_pDeadlineHeap[ child ];
+        index = child;
+        child = 2 * index + 1;
+    }
+    m_pDeadlineHeap[ index ] = last;
+}
+
+bool TaskScheduler::TryAddNumaTaskSets( uint32_t threadNum )
+{
+    ITaskSet* pTaskSet = m_pTaskSetInboxPerNumaNode[ m_pThreadDataStore[ threadNum ].numaNode ].ReaderReadAll();
+    if( !pTaskSet )
+    {
+        return false;
+    }
+    while( pTaskSet )
+    {
+        // get next before adding, as the task set may complete and be re-used
+        ITaskSet* pNext = pTaskSet->pNext;
+        AtomicAdd( &m_NumNumaInboxTaskSets, -1 );
+        AddTaskSetPartitions( pTaskSet );
+        pTaskSet = pNext;
+    }
+    return true;
+}
+
+void TaskScheduler::AllocateThreadMemory( uint32_t threadNum )
+{
+    ThreadDataStore& threadData = m_pThreadDataStore[ threadNum ];
+    AtomicStore( &threadData.numaNode, GetCurrentNumaNode(), MEMORY_ORDER_RELAXED );
+
+    // pipes are reserved so that no allocation is needed during scheduling
+    // unless the pipes need to grow beyond the configured capacity
+    uint32_t numSegments = ( m_Config.pipeCapacity + ( 1 << PIPESIZE_LOG2 ) - 1 ) >> PIPESIZE_LOG2;
+    TaskPipe* pPipes = new TaskPipe[ TASK_PRIORITY_NUM ];
+    for( int priority = 0; priority < TASK_PRIORITY_NUM; ++priority )
+    {
+        pPipes[ priority ].Reserve( numSegments );
+    }
+    m_pPipesPerThread[ threadNum ] = pPipes;
+
+    // each thread owns a contiguous range of the pool, linked into its free list
+    TaskPoolSlot* pSlots = m_pTaskPool + threadNum * m_Config.pooledTaskSetsPerThread;
+    for( uint32_t slot = 0; slot < m_Config.pooledTaskSetsPerThread; ++slot )
+    {
+        pSlots[slot].pDestroy = NULL;
+        pSlots[slot].pNext = slot + 1 < m_Config.pooledTaskSetsPerThread ? &pSlots[slot + 1] : NULL;
+    }
+    threadData.pPooledTaskSetsFree = m_Config.pooledTaskSetsPerThread ? pSlots : NULL;
+}
+
+uint32_t TaskScheduler::GetCurrentNumaNode() const
+{
+    int32_t cpu = GetCurrentCPU();
+    if( !m_pNumaNodePerCPU || cpu < 0 || (uint32_t)cpu >= m_NumCPUs )
+    {
+        return 0;
+    }
+    return m_pNumaNodePerCPU[ cpu ];
+}
+
+void TaskScheduler::AddDeadlineTaskSet( ITaskSet* pTaskSet )
+{
+    pTaskSet->m_DeadlineRangeStart = 0;
+    SpinLock( m_DeadlineTaskSetsLock );
+    while( m_DeadlineHeapSize == m_DeadlineHeapCapacity )
+    {
+        // grow without holding the lock, so other threads can take ranges whilst we allocate
+        uint32_t capacity = m_DeadlineHeapCapacity;
+        SpinUnlock( m_DeadlineTaskSetsLock );
+        DeadlineTaskSet* pHeap = new DeadlineTaskSet[ 2 * capacity ];
+        SpinLock( m_DeadlineTaskSetsLock );
+        if( capacity == m_DeadlineHeapCapacity )
+        {
+            for( uint32_t index = 0; index < m_DeadlineHeapSize; ++index )
+            {
+                pHeap[ index ] = m_pDeadlineHeap[ index ];
+            }
+            DeadlineTaskSet* pOldHeap = m_pDeadlineHeap;
+            m_pDeadlineHeap = pHeap;
+            m_DeadlineHeapCapacity = 2 * capacity;
+            pHeap = pOldHeap;
+        }
+        SpinUnlock( m_DeadlineTaskSetsLock );
+        delete[] pHeap;
+        SpinLock( m_DeadlineTaskSetsLock );
+    }
+
+    // move up from the end of the heap, the order added keeps equal deadlines first in first out
+    DeadlineTaskSet entry;
+    entry.deadlineNS = pTaskSet->m_DeadlineNS;
+    entry.order      = m_NumDeadlineTaskSetsAdded++;
+    entry.pTaskSet   = pTaskSet;
+    uint32_t index = m_DeadlineHeapSize++;
+    while( index && IsBefore( entry, m_pDeadlineHeap[ ( index - 1 ) / 2 ] ) )
+    {
+        m_pDeadlineHeap[ index ] = m_pDeadlineHeap[ ( index - 1 ) / 2 ];
+        index = ( index - 1 ) / 2;
+    }
+    m_pDeadlineHeap[ index ] = entry;
+    SpinUnlock( m_DeadlineTaskSetsLock );
+
+    // the atomic increment is the full barrier needed before WakeThreads, see HaveTasks
+    AtomicAdd( &m_NumDeadlineTaskSets, 1 );
+    uint32_t partitionSize = GetPartitionSize( pTaskSet );
+    WakeThreads( (int32_t)( ( pTaskSet->m_SetSize - 1 ) / partitionSize ) + 1 );
+}
+
+void TaskScheduler::SplitAndExecuteRange( ITaskSet* pTaskSet, TaskSetPartition range, uint32_t threadNum )
+{
+    // Lazy binary splitting: run the range in partition sized pieces, and whenever our pipe
+    // is empty split off the upper half of what remains, so there is always work to steal.
+    TaskPipe& pipe = m_pPipesPerThread[ threadNum ][ pTaskSet->m_Priority ];
+    uint32_t partitionSize = GetPartitionSize( pTaskSet );
+    while( range.end - range.start > partitionSize && !AtomicLoad( &pTaskSet->m_bCancelled, MEMORY_ORDER_RELAXED ) )
+    {
+        if( pipe.IsPipeEmpty() )
+        {
+            uint32_t numPartitions = ( range.end - range.start + partitionSize - 1 ) / partitionSize;
+            TaskSetInfo splitInfo;
+            splitInfo.pTask           = pTaskSet;
+            splitInfo.partition.start = range.start + ( numPartitions / 2 ) * partitionSize;
+            splitInfo.partition.end   = range.end;
+
+            // count must be increased before the split is visible, see PartitionComplete
+            AtomicAdd( &pTaskSet->m_CompletionCount, +1 );
+            if( pipe.WriterTryWriteFront( splitInfo ) )
+            {
+                range.end = splitInfo.partition.start;
+                BASE_MEMORYBARRIER_FULL(); // see WakeThreads
+                WakeThreads( 1 );
+                continue;
+            }
+            // pipe could not grow, so run it all here
+            AtomicAdd( &pTaskSet->m_CompletionCount, -1 );
+        }
+
+        TaskSetPartition subRange = { range.start, range.start + partitionSize };
+        ExecuteRange( pTaskSet, subRange, threadNum );
+        range.start = subRange.end;
+    }
+    ExecuteRange( pTaskSet, range, threadNum );
+}
+
+void TaskScheduler::ExecuteRange( ITaskSet* pTaskSet, TaskSetPartition range, uint32_t threadNum )
+{
+    if( AtomicLoad( &pTaskSet->m_bCancelled, MEMORY_ORDER_RELAXED ) )
+    {
+        // skip, the caller still completes the partition
+        return;
+    }
+
+    // count tasks in progress on the fiber, as only fibers running a task can park, see TryParkFiber
+    Fiber* pFiber = m_pThreadDataStore[ threadNum ].pCurrentFiber;
+    if( pFiber )
+    {
+        ++pFiber->taskDepth;
+        ExecuteRangeTimed( pTaskSet, range, threadNum );
+        --pFiber->taskDepth;
+    }
+    else
+    {
+        ExecuteRangeTimed( pTaskSet, range, threadNum );
+    }
+}
+
+void TaskScheduler::ExecuteRangeTimed( ITaskSet* pTaskSet, TaskSetPartition range, uint32_t threadNum )
+{
+    if( !m_AutoPartitionTargetCycles )
+    {
+        pTaskSet->ExecuteRange( range, threadNum );
+        return;
+    }
+
+    uint64_t startCycles = GetCycleCount();
+    pTaskSet->ExecuteRange( range, threadNum );
+    float cyclesPerElement = (float)( GetCycleCount() - startCycles ) / (float)( range.end - range.start );
+
+    // Moving average over partitions and runs. Threads can race to update this,
+    // but that only loses a sample.
+    float average = AtomicLoad( &pTaskSet->m_CyclesPerElement, MEMORY_ORDER_RELAXED );
+    if( average > 0.0f )
+    {
+        cyclesPerElement = average + 0.25f * ( cyclesPerElement - average );
+    }
+    AtomicStore( &pTaskSet->m_CyclesPerElement, cyclesPerElement, MEMORY_ORDER_RELAXED );
+}
+
+uint32_t TaskScheduler::GetPartitionSize( const ITaskSet* pTaskSet ) const
+{
+    uint32_t partitionSize = pTaskSet->m_SetSize / AtomicLoad( &m_NumPartitions, MEMORY_ORDER_RELAXED );
+    float cyclesPerElement = AtomicLoad( &pTaskSet->m_CyclesPerElement, MEMORY_ORDER_RELAXED );
+    if( m_AutoPartitionTargetCycles && cyclesPerElement > 0.0f )
+    {
+        // size to take the target time using the cost measured on previous runs, see ExecuteRange
+        float autoPartitionSize = (float)m_AutoPartitionTargetCycles / cyclesPerElement;
+        partitionSize = autoPartitionSize < (float)pTaskSet->m_SetSize ? (uint32_t)autoPartitionSize : pTaskSet->m_SetSize;
+    }
+    if( pTaskSet->m_MaxPartitions )
+    {
+        uint32_t minPartitionSize = ( pTaskSet->m_SetSize + pTaskSet->m_MaxPartitions - 1 ) / pTaskSet->m_MaxPartitions;
+        if( partitionSize < minPartitionSize ) { partitionSize = minPartitionSize; }
+    }
+    if( partitionSize < pTaskSet->m_MinRange ) { partitionSize = pTaskSet->m_MinRange; }
+    if( partitionSize == 0 ) { partitionSize = 1; }
+    return partitionSize;
+}
+
+void TaskScheduler::SetDependentsPending( ITaskSet* pTaskSet )
+{
+    // Dependents are marked as not complete when a task they depend on is added, so that
+    // waiting on a dependent task does not return before it has been launched.
+    // If a dependent is already pending, so are its dependents.
+    Dependency* pDependent = pTaskSet->m_pDependents;
+    while( pDependent )
+    {
+        ITaskSet* pTaskToRun = pDependent->pTaskToRunOnCompletion;
+        if( 0 == AtomicCompareAndSwap( (volatile uint32_t*)&pTaskToRun->m_CompletionCount, 1, 0 ) )
+        {
+            AtomicStore( &pTaskToRun->m_bCancelled, false, MEMORY_ORDER_RELAXED );
+            SetDependentsPending( pTaskToRun );
+        }
+        pDependent = pDependent->pNext;
+    }
+}
+
+void TaskScheduler::PartitionComplete( ITaskSet* pTaskSet )
+{
+    // m_CompletionCount holds one count per partition, one for AddTaskSetToPipe whilst it adds them,
+    // and one more which is released by the last partition, so only one thread sees the count
+    // drop to 1 and completes the task.
+    int32_t prevCount = AtomicAdd( &pTaskSet->m_CompletionCount, -1 );
+    if( 2 == prevCount )
+    {
+        // The task is complete, and so can be re-used or deleted, once the count is released.
+        // Dependents are launched after this so that waiting on the last task of a graph
+        // ensures all the tasks in it are complete. The dependency list is safe to walk as the
+        // dependents have not been launched, so cannot be complete.
+        Dependency* pDependent = pTaskSet->m_pDependents;
+        uint64_t deadlineNS = pTaskSet->m_DeadlineNS;
+        ITaskSet::CompletionFunction pCompletionFunction = pTaskSet->m_pCompletionFunction;
+        void* pCompletionArg = pTaskSet->m_pCompletionArg;
+        pTaskSet->m_pCompletionFunction = NULL;
+        AtomicAdd( &pTaskSet->m_CompletionCount, -1 );
+
+        if( deadlineNS )
+        {
+            // shared rather than per thread, as the thread adding the task set can complete it
+            AtomicAdd( &m_NumDeadlineTaskSetsRun, 1, MEMORY_ORDER_RELAXED );
+            if( GetTimeNS() > deadlineNS )
+            {
+                AtomicAdd( &m_NumDeadlineMisses, 1, MEMORY_ORDER_RELAXED );
+            }
+        }
+
+        // The atomic decrement is a full barrier: either we see a waiting thread, or it sees
+        // the task is complete, see WaitForTaskSetCompletion. pTaskSet is only used for
+        // comparison from here, as it may already have been re-used or deleted.
+        if( AtomicLoad( &m_NumThreadsWaitingForTaskSets ) || AtomicLoad( &m_NumParkedFibers ) )
+        {
+            WakeThreadsWaitingForTaskSet( pTaskSet );
+        }
+
+        while( pDependent )
+        {
+            // get next before launching, as the dependent task may run and complete
+            Dependency* pNext       = pDependent->pNext;
+            ITaskSet*   pTaskToRun  = pDependent->pTaskToRunOnCompletion;
+            int32_t prevCompleted = AtomicAdd( &pTaskToRun->m_DependenciesCompletedCount, 1 );
+            if( prevCompleted + 1 == pTaskToRun->m_DependenciesCount )
+            {
+                // all dependencies complete, reset for next time and launch
+                AtomicStore( &pTaskToRun->m_DependenciesCompletedCount, 0, MEMORY_ORDER_RELAXED );
+                AddTaskSetToPipe( pTaskToRun );
+            }
+            pDependent = pNext;
+        }
+
+        // task sets added with AddTaskSetFireAndForget are owned by the scheduler
+        FreePooledTaskSet( pTaskSet );
+
+        if( pCompletionFunction )
+        {
+            pCompletionFunction( pCompletionArg );
+        }
+    }
+}
+
+void* TaskScheduler::AllocatePooledTaskSet( void (*pDestroy)( ITaskSet* ) )
+{
+    ThreadDataStore& threadData = m_pThreadDataStore[ gtl_threadNum ];
+    if( !threadData.pPooledTaskSetsFree )
+    {
+        // take any slots freed by other threads
+        threadData.pPooledTaskSetsFree = threadData.pooledTaskSetsFreed.ReaderReadAll();
+        if( !threadData.pPooledTaskSetsFree )
+        {
+            return NULL;
+        }
+    }
+    TaskPoolSlot* pSlot = threadData.pPooledTaskSetsFree;
+    threadData.pPooledTaskSetsFree = pSlot->pNext;
+    pSlot->pDestroy = pDestroy;
+    return pSlot->taskSet;
+}
+
+void TaskScheduler::FreePooledTaskSet( ITaskSet* pTaskSet )
+{
+    // unsigned offset so task sets before the pool are also out of range
+    uintptr_t offset = (uintptr_t)pTaskSet - (uintptr_t)m_pTaskPool;
+    uint32_t slot = (uint32_t)( offset / sizeof( TaskPoolSlot ) );
+    if( offset >= (uintptr_t)m_NumThreads * m_Config.pooledTaskSetsPerThread * sizeof( TaskPoolSlot ) )
+    {
+        return;
+    }
+    TaskPoolSlot* pSlot = &m_pTaskPool[ slot ];
+    pSlot->pDestroy( pTaskSet );
+
+    uint32_t ownerThread = slot / m_Config.pooledTaskSetsPerThread;
+    ThreadDataStore& ownerData = m_pThreadDataStore[ ownerThread ];
+    if( ownerThread == gtl_threadNum )
+    {
+        pSlot->pNext = ownerData.pPooledTaskSetsFree;
+        ownerData.pPooledTaskSetsFree = pSlot;
+    }
+    else
+    {
+        ownerData.pooledTaskSetsFreed.WriterWriteFront( pSlot );
+    }
+}
+
+
+void    TaskScheduler::AddTaskSetToPipe( ITaskSet* pTaskSet )
+{
+    // no one owns the task as yet, so just set count, see PartitionComplete
+    AtomicStore( &pTaskSet->m_CompletionCount, 2, MEMORY_ORDER_RELAXED );
+    if( 0 == pTaskSet->m_DependenciesCount )
+    {
+        // task sets with dependencies are cleared when pending, so they can be cancelled before launch
+        AtomicStore( &pTaskSet->m_bCancelled, false, MEMORY_ORDER_RELAXED );
+    }
+    SetDependentsPending( pTaskSet );
+
+    if( pTaskSet->m_DeadlineNS && pTaskSet->m_SetSize )
+    {
+        // partitions are taken from the deadline queue, which keeps the count held whilst adding
+        AddDeadlineTaskSet( pTaskSet );
+        return;
+    }
+
+    uint32_t node = pTaskSet->m_PreferredNumaNode;
+    if( node < m_NumNumaNodes && m_pNumThreadsPerNumaNode[ node ] && pTaskSet->m_SetSize &&
+        node != m_pThreadDataStore[ gtl_threadNum ].numaNode )
+    {
+        // a thread on the node divides it into its own pipe, keeping the count held, see TryAddNumaTaskSets
+        m_pTaskSetInboxPerNumaNode[ node ].WriterWriteFront( pTaskSet );
+
+        // full barrier: either we see a thread on the node sleeping, or it sees the task set
+        AtomicAdd( &m_NumNumaInboxTaskSets, 1 );
+        for( uint32_t thread = 1; thread < m_Config.numThreads; ++thread )
+        {
+            if( node == m_pThreadDataStore[ thread ].numaNode && WakeThread( thread ) )
+            {
+                break;
+            }
+        }
+        return;
+    }
+
+    AddTaskSetPartitions( pTaskSet );
+}
+
+void    TaskScheduler::AddTaskSetPartitions( ITaskSet* pTaskSet )
+{
+    TaskSetInfo info;
+    info.pTask = pTaskSet;
+    info.partition.start = 0;
+    info.partition.end = pTaskSet->m_SetSize;
+
+    // divide task up and add to pipe, lazy split mode adds it whole and splits whilst running
+    int32_t numAdded = 0;
+    uint32_t numToRun = info.pTask->m_SetSize;
+    if( TASK_PARTITION_MODE_EAGER == m_Config.partitionMode )
+    {
+        numToRun = GetPartitionSize( pTaskSet );
+    }
+    uint32_t rangeLeft = info.partition.end - info.partition.start ;
+    while( rangeLeft )
+    {
+        if( numToRun > rangeLeft )
+        {
+            numToRun = rangeLeft;
+        }
+        info.partition.start = pTaskSet->m_SetSize - rangeLeft;
+        info.partition.end = info.partition.start + numToRun;
+        rangeLeft -= numToRun;
+
+        // add the partition to the pipe
+        AtomicAdd( &info.pTask->m_CompletionCount, +1 );
+        if( !m_pPipesPerThread[ gtl_threadNum ][ pTaskSet->m_Priority ].WriterTryWriteFront( info ) )
+        {
+            // pipes only fail to write if they could not grow, so run the task
+            BASE_MEMORYBARRIER_FULL();
+            WakeThreads( numAdded );
+            numAdded = 0;
+            ExecuteRange( pTaskSet, info.partition, gtl_threadNum );
+            PartitionComplete( pTaskSet );
+        }
+        else
+        {
+            ++numAdded;
+        }
+    }
+
+    // all partitions added, release count held whilst adding.
+    // The atomic decrement is also the full barrier needed before WakeThreads.
+    PartitionComplete( pTaskSet );
+
+    WakeThreads( numAdded );
+}
+
+void    TaskScheduler::WaitForNewTasks( uint32_t threadNum )
+{
+    // Sleep until woken by WakeThreads, which claims sleeping threads by swapping their
+    // state to awake before signalling, so each sleep consumes exactly one signal.
+    ThreadDataStore& threadData = m_pThreadDataStore[ threadNum ];
+    uint64_t sleepStartNS = GetTimeNS();
+    AtomicAdd( &m_NumThreadsActive, -1 );
+    AtomicStore( &threadData.threadState, THREAD_STATE_SLEEPING, MEMORY_ORDER_RELAXED );
+
+    // full barrier: either WakeThreads sees us sleeping, or we see the tasks it added
+    AtomicAdd( &m_NumThreadsSleeping, 1 );
+    SleepThread( threadNum, HaveTasks( threadNum ) || !AtomicLoad( &m_bRunning ) );
+    AtomicAdd( &m_NumThreadsSleeping, -1 );
+    AtomicAdd( &m_NumThreadsActive, 1 );
+    AdaptSpinLimitAfterSleep( threadData, GetTimeNS() - sleepStartNS );
+
+    // the OS may have moved us whilst sleeping
+    UpdateCacheGroup( threadNum );
+}
+
+void    TaskScheduler::WaitForTaskSetCompletion( const ITaskSet* pTaskSet, uint32_t threadNum )
+{
+    // Sleep until the task set completes, or we are woken to run new tasks.
+    // Uses the same sleep state as WaitForNewTasks so that WakeThreads can use this thread.
+    ThreadDataStore& threadData = m_pThreadDataStore[ threadNum ];
+    uint64_t sleepStartNS = GetTimeNS();
+    AtomicStore( &threadData.pWaitingForTaskSet, pTaskSet, MEMORY_ORDER_RELAXED );
+    AtomicStore( &threadData.threadState, THREAD_STATE_SLEEPING, MEMORY_ORDER_RELAXED );
+    AtomicAdd( &m_NumThreadsSleeping, 1 );
+
+    // full barrier: either PartitionComplete sees us waiting, or we see the task set complete
+    AtomicAdd( &m_NumThreadsWaitingForTaskSets, 1 );
+    SleepThread( threadNum, 0 == AtomicLoad( &pTaskSet->m_CompletionCount ) || HaveTasks( threadNum ) );
+    AtomicAdd( &m_NumThreadsWaitingForTaskSets, -1 );
+    AtomicAdd( &m_NumThreadsSleeping, -1 );
+    AtomicStore( &threadData.pWaitingForTaskSet, NULL, MEMORY_ORDER_RELAXED );
+    AdaptSpinLimitAfterSleep( threadData, GetTimeNS() - sleepStartNS );
+    UpdateCacheGroup( threadNum );
+}
+
+void    TaskScheduler::WaitForPinnedTaskCompletion( const IPinnedTask* pTask, uint32_t threadNum )
+{
+    // As WaitForTaskSetCompletion, but woken by RunPinnedTasks on the task's thread
+    ThreadDataStore& threadData = m_pThreadDataStore[ threadNum ];
+    uint64_t sleepStartNS = GetTimeNS();
+    AtomicStore( &threadData.pWaitingForPinnedTask, pTask, MEMORY_ORDER_RELAXED );
+    AtomicStore( &threadData.threadState, THREAD_STATE_SLEEPING, MEMORY_ORDER_RELAXED );
+    AtomicAdd( &m_NumThreadsSleeping, 1 );
+
+    // full barrier: either RunPinnedTasks sees us waiting, or we see the task complete
+    AtomicAdd( &m_NumThreadsWaitingForPinnedTasks, 1 );
+    SleepThread( threadNum, 0 == AtomicLoad( &pTask->m_RunningCount ) || HaveTasks( threadNum ) );
+    AtomicAdd( &m_NumThreadsWaitingForPinnedTasks, -1 );
+    AtomicAdd( &m_NumThreadsSleeping, -1 );
+    AtomicStore( &threadData.pWaitingForPinnedTask, NULL, MEMORY_ORDER_RELAXED );
+    AdaptSpinLimitAfterSleep( threadData, GetTimeNS() - sleepStartNS );
+    UpdateCacheGroup( threadNum );
+}
+
+void    TaskScheduler::SleepThread( uint32_t threadNum, bool bCancelSleep )
+{
+    // Called with our state set to sleeping followed by a full barrier. If there are timed tasks
+    // one sleeping thread becomes the timer thread, and sleeps only until the next deadline.
+    ThreadDataStore& threadData = m_pThreadDataStore[ threadNum ];
+    bool bTimerThread = false;
+    uint64_t sleepUntilNS = NO_DEADLINE;
+    if( AtomicLoad( &m_NumTimedTasks ) && NO_THREAD == AtomicLoad( &m_TimerSleepThread, MEMORY_ORDER_RELAXED ) &&
+        NO_THREAD == AtomicCompareAndSwap( &m_TimerSleepThread, threadNum, NO_THREAD ) )
+    {
+        // sequentially consistent store is a full barrier: either SetTimedTaskDeadline sees
+        // when we wake, or we see its deadline
+        bTimerThread = true;
+        sleepUntilNS = AtomicLoad( &m_TimedTaskNextDeadlineNS );
+        AtomicStore( &m_TimerSleepUntilNS, sleepUntilNS );
+        if( AtomicLoad( &m_TimedTaskNextDeadlineNS ) < sleepUntilNS || GetTimeNS() >= sleepUntilNS )
+        {
+            bCancelSleep = true;
+        }
+    }
+
+    bool bWait = true;
+    if( bCancelSleep )
+    {
+        // cancel sleep unless we have already been claimed, in which case consume the signal
+        bWait = THREAD_STATE_SLEEPING != AtomicCompareAndSwap( &threadData.threadState, THREAD_STATE_AWAKE, THREAD_STATE_SLEEPING );
+    }
+    if( bWait )
+    {
+        if( NO_DEADLINE == sleepUntilNS )
+        {
+            SemaphoreWait( threadData.wakeSemaphore );
+        }
+        else
+        {
+            uint64_t nowNS = GetTimeNS();
+            if( !SemaphoreWaitTimeout( threadData.wakeSemaphore, sleepUntilNS > nowNS ? sleepUntilNS - nowNS : 0 ) &&
+                THREAD_STATE_SLEEPING != AtomicCompareAndSwap( &threadData.threadState, THREAD_STATE_AWAKE, THREAD_STATE_SLEEPING ) )
+            {
+                // claimed as we timed out, so consume the signal
+                SemaphoreWait( threadData.wakeSemaphore );
+            }
+        }
+    }
+    if( bTimerThread )
+    {
+        // the caller checks for due timed tasks in TryRunTask
+        AtomicStore( &m_TimerSleepThread, NO_THREAD, MEMORY_ORDER_RELEASE );
+    }
+}
+
+void    TaskScheduler::UpdateCacheGroup( uint32_t threadNum )
+{
+    if( !m_pCacheGroupPerCPU )
+    {
+        return;
+    }
+    int32_t cpu = GetCurrentCPU();
+    uint32_t cacheGroup = 0;
+    if( cpu >= 0 && (uint32_t)cpu < m_NumCPUs )
+    {
+        cacheGroup = m_pCacheGroupPerCPU[ cpu ];
+    }
+
+    // only write if changed, as other threads read this when stealing
+    if( cacheGroup != m_pThreadDataStore[ threadNum ].cacheGroup )
+    {
+        AtomicStore( &m_pThreadDataStore[ threadNum ].cacheGroup, cacheGroup, MEMORY_ORDER_RELAXED );
+    }
+}
+
+void    TaskScheduler::WakeThreadsWaitingForTaskSet( const ITaskSet* pTaskSet )
+{
+    for( uint32_t thread = 0; thread < m_NumThreads; ++thread )
+    {
+        const ThreadDataStore& threadData = m_pThreadDataStore[ thread ];
+        if( pTaskSet == AtomicLoad( &threadData.pWaitingForTaskSet, MEMORY_ORDER_RELAXED ) )
+        {
+            WakeThread( thread );
+        }
+        else if( AtomicLoad( &threadData.numParkedFibers, MEMORY_ORDER_RELAXED ) )
+        {
+            // the thread resumes its parked fibers between tasks, so only needs waking if asleep
+            for( uint32_t fiber = 1; fiber <= m_Config.fibersPerThread; ++fiber )
+            {
+                if( pTaskSet == AtomicLoad( &threadData.pFibers[ fiber ].pWaitingForTaskSet, MEMORY_ORDER_RELAXED ) )
+                {
+                    WakeThread( thread );
+                    break;
+                }
+            }
+        }
+    }
+}
+
+void    TaskScheduler::WakeThreadsWaitingForPinnedTask( const IPinnedTask* pTask )
+{
+    for( uint32_t thread = 0; thread < m_NumThreads; ++thread )
+    {
+        if( pTask == AtomicLoad( &m_pThreadDataStore[ thread ].pWaitingForPinnedTask, MEMORY_ORDER_RELAXED ) )
+        {
+            WakeThread( thread );
+        }
+    }
+}
+
+void    TaskScheduler::WakeThreads( int32_t maxToWake_ )
+{
+    // callers must have a full barrier between adding tasks and calling this, so that
+    // either we see a thread sleeping or it sees the tasks, see WaitForNewTasks
+    if( 0 == AtomicLoad( &m_NumThreadsSleeping ) || maxToWake_ <= 0 )
+    {
+        // no syscall or scan when no threads are sleeping
+        return;
+    }
+    int32_t numWoken = 0;
+    uint32_t numActiveThreads = AtomicLoad( &m_NumActiveThreads, MEMORY_ORDER_RELAXED );
+    for( uint32_t thread = 0; thread < m_NumThreads && numWoken < maxToWake_; ++thread )
+    {
+        if( thread >= numActiveThreads && thread < m_Config.numThreads )
+        {
+            // parked, see SetNumActiveThreads
+            continue;
+        }
+        if( WakeThread( thread ) )
+        {
+            ++numWoken;
+        }
+    }
+}
+
+bool    TaskScheduler::WakeThread( uint32_t threadNum )
+{
+    ThreadDataStore& threadData = m_pThreadDataStore[ threadNum ];
+    if( THREAD_STATE_SLEEPING == AtomicLoad( &threadData.threadState, MEMORY_ORDER_RELAXED ) &&
+        THREAD_STATE_SLEEPING == AtomicCompareAndSwap( &threadData.threadState, THREAD_STATE_AWAKE, THREAD_STATE_SLEEPING ) )
+    {
+        SemaphoreSignal( threadData.wakeSemaphore, 1 );
+        return true;
+    }
+    return false;
+}
+
+void    TaskScheduler::WaitforTaskSet( const ITaskSet* pTaskSet )
+{
+	if( pTaskSet )
+	{
+		uint32_t threadNum = gtl_threadNum;
+		ThreadDataStore& threadData = m_pThreadDataStore[ threadNum ];
+		uint32_t spinCount = 0;
+		// acquire, so the effects of the task set are visible once complete
+		while( AtomicLoad( &pTaskSet->m_CompletionCount, MEMORY_ORDER_ACQUIRE ) )
+		{
+			if( m_pFibers && TryParkFiber( threadNum, pTaskSet ) )
+			{
+				// returns once resumed, which may be before completion if it was already parked
+				continue;
+			}
+			RunPinnedTasks( threadNum );
+			if( TryRunTask( threadNum ) )
+			{
+				spinCount = 0;
+			}
+			else if( ++spinCount > threadData.spinLimit )
+			{
+				// nothing to run, so sleep until the task set completes rather than burn a core
+				WaitForTaskSetCompletion( pTaskSet, threadNum );
+				spinCount = 0;
+			}
+			else
+			{
+				SpinPause( spinCount );
+			}
+		}
+	}
+	else
+	{
+			RunPinnedTasks( gtl_threadNum );
+			TryRunTask( gtl_threadNum );
+	}
+}
+
+void    TaskScheduler::WaitforPinnedTask( const IPinnedTask* pTask_ )
 {
-	struct TaskSetInfo
+	uint32_t threadNum = gtl_threadNum;
+	ThreadDataStore& threadData = m_pThreadDataStore[ threadNum ];
+	uint32_t spinCount = 0;
+	// acquire, so the effects of the task are visible once complete
+	while( AtomicLoad( &pTask_->m_RunningCount, MEMORY_ORDER_ACQUIRE ) )
 	{
-		ITaskSet*           pTask;
-		TaskSetPartition    partition;
-	};
-
-	// we derive class TaskPipe rather than typedef to get forward declaration working easily
-	class TaskPipe : public LockLessMultiReadPipe<PIPESIZE_LOG2,enki::TaskSetInfo> {};
+		RunPinnedTasks( threadNum );
+		if( TryRunTask( threadNum ) )
+		{
+			spinCount = 0;
+		}
+		else if( ++spinCount > threadData.spinLimit )
+		{
+			// nothing to run, so sleep until the pinned task completes rather than burn a core
+			WaitForPinnedTaskCompletion( pTask_, threadNum );
+			spinCount = 0;
+		}
+		else
+		{
+			SpinPause( spinCount );
+		}
+	}
+}
 
-	struct ThreadArgs
+bool    TaskScheduler::AddPinnedTask( IPinnedTask* pTask_ )
+{
+	assert( pTask_->threadNum < m_NumThreads );
+	if( pTask_->threadNum >= m_Config.numThreads &&
+		!AtomicLoad( &m_pThreadDataStore[ pTask_->threadNum ].bExternalThreadRegistered, MEMORY_ORDER_RELAXED ) )
 	{
-		uint32_t		threadNum;
-		TaskScheduler*  pTaskScheduler;
-	};
+		// no thread would run it, and WaitforAll would wait for it forever
+		assert( !"AddPinnedTask: external thread slot is not registered" );
+		return false;
+	}
+	AtomicStore( &pTask_->m_RunningCount, 1, MEMORY_ORDER_RELAXED );
+	m_pPinnedTaskListPerThread[ pTask_->threadNum ].WriterWriteFront( pTask_ );
+
+	// the CAS in WriterWriteFront is the full barrier needed before checking if the thread is sleeping
+	WakeThread( pTask_->threadNum );
+	return true;
 }
 
+void    TaskScheduler::AddTimedTask( TimedTask* pTimedTask_, uint64_t delayNS_, uint64_t periodNS_ )
+{
+    assert( m_pTimedTaskInbox );
+    assert( pTimedTask_->pTaskSet );
+    assert( !pTimedTask_->GetIsActive() );
+    uint64_t deadlineNS = GetTimeNS() + delayNS_;
+    pTimedTask_->m_DeadlineNS     = deadlineNS;
+    pTimedTask_->m_PeriodNS       = periodNS_;
+    AtomicStore( &pTimedTask_->m_bStopRequested, 0, MEMORY_ORDER_RELAXED );
+    AtomicStore( &pTimedTask_->m_bActive, 1, MEMORY_ORDER_RELAXED );
+    AtomicAdd( &m_NumTimedTasks, 1 );
 
-THREADFUNC_DECL TaskScheduler::TaskingThreadFunction( void* pArgs )
+    // the thread which next processes timed tasks inserts it into the timer wheel
+    // once written the timer thread owns the task, so use the local deadline
+    m_pTimedTaskInbox->WriterWriteFront( pTimedTask_ );
+    SetTimedTaskDeadline( deadlineNS );
+}
+
+void    TaskScheduler::StopTimedTask( TimedTask* pTimedTask_ )
 {
-	ThreadArgs args					= *(ThreadArgs*)pArgs;
-	uint32_t threadNum				= args.threadNum;
-	TaskScheduler*  pTS				= args.pTaskScheduler;
-    gtl_threadNum      = threadNum;
-	AtomicAdd( &pTS->m_NumThreadsActive, 1 );
-    
-    uint32_t spinCount = 0;
-    while( pTS->m_bRunning )
+    if( !pTimedTask_->GetIsActive() )
     {
-        if(!pTS->TryRunTask( threadNum ) )
+        return;
+    }
+    // release, so ProcessTimedTasks sees the task's request when it sees ours
+    AtomicStore( &pTimedTask_->m_bStopRequested, 1, MEMORY_ORDER_RELAXED );
+    AtomicStore( &m_bTimedTaskStopRequested, 1, MEMORY_ORDER_RELEASE );
+
+    // process timed tasks as soon as possible to remove it
+    SetTimedTaskDeadline( 0 );
+}
+
+void    TaskScheduler::SetTimedTaskDeadline( uint64_t deadlineNS )
+{
+    uint64_t nextDeadlineNS = AtomicLoad( &m_TimedTaskNextDeadlineNS, MEMORY_ORDER_RELAXED );
+    while( deadlineNS < nextDeadlineNS )
+    {
+        uint64_t prevDeadlineNS = AtomicCompareAndSwap( &m_TimedTaskNextDeadlineNS, deadlineNS, nextDeadlineNS );
+        if( prevDeadlineNS == nextDeadlineNS )
         {
-            // no tasks, will spin then wait
-            ++spinCount;
-            if( spinCount > SPIN_COUNT )
+            // full barrier: either we see the timer thread sleeping past the deadline, or it sees
+            // the deadline, see SleepThread. With no timer thread, wake a thread to become it.
+            uint32_t timerThread = AtomicLoad( &m_TimerSleepThread );
+            if( NO_THREAD == timerThread )
             {
-				bool bHaveTasks = false;
-				for( uint32_t thread = 0; thread < pTS->m_NumThreads; ++thread )
-				{
-					if( !pTS->m_pPipesPerThread[ thread ].IsPipeEmpty() )
-					{
-						bHaveTasks = true;
-						break;
-					}
-				}
-				if( bHaveTasks )
-				{
-					// keep trying
-					spinCount = 0;
-				}
-				else
-				{
-					AtomicAdd( &pTS->m_NumThreadsActive, -1 );
-					EventWait( pTS->m_NewTaskEvent, EVENTWAIT_INFINITE );
-					AtomicAdd( &pTS->m_NumThreadsActive, 1 );
-					spinCount = 0;
-				}
+                WakeThreads( 1 );
+            }
+            else if( AtomicLoad( &m_TimerSleepUntilNS ) > deadlineNS )
+            {
+                WakeThread( timerThread );
             }
+            return;
         }
+        nextDeadlineNS = prevDeadlineNS;
     }
-
-    AtomicAdd( &pTS->m_NumThreadsRunning, -1 );
-    return 0;
+    // an earlier deadline is already set, so timed tasks will be processed before ours is due
 }
 
-
-void TaskScheduler::StartThreads()
+void    TaskScheduler::ProcessTimedTasks()
 {
-    if( m_bHaveThreads )
+    // one thread at a time processes timed tasks, others carry on running tasks
+    if( 0 != AtomicLoad( &m_TimedTaskLock, MEMORY_ORDER_RELAXED ) || 0 != AtomicCompareAndSwap( &m_TimedTaskLock, 1, 0, MEMORY_ORDER_ACQUIRE ) )
     {
         return;
     }
-    m_bRunning = true;
 
-    m_NewTaskEvent = EventCreate();
-
-    // we create one less thread than m_NumThreads as the main thread counts as one
-    m_pThreadNumStore = new ThreadArgs[m_NumThreads];
-    m_pThreadIDs      = new threadid_t[m_NumThreads];
-	m_pThreadNumStore[0].threadNum      = 0;
-	m_pThreadNumStore[0].pTaskScheduler = this;
-	m_pThreadIDs[0] = 0;
-    for( uint32_t thread = 1; thread < m_NumThreads; ++thread )
+    bool bProcess = true;
+    while( bProcess )
     {
-		m_pThreadNumStore[thread].threadNum      = thread;
-		m_pThreadNumStore[thread].pTaskScheduler = this;
-        ThreadCreate( &m_pThreadIDs[thread], TaskingThreadFunction, &m_pThreadNumStore[thread] );
-        ++m_NumThreadsRunning;
-    }
-
-    // ensure we have sufficient tasks to equally fill either all threads including main
-    // or just the threads we've launched, this is outside the firstinit as we want to be able
-    // to runtime change it
-	if( 1 == m_NumThreads )
-	{
-		m_NumPartitions = 1;
-	}
-	else
-	{
-		m_NumPartitions = m_NumThreads * (m_NumThreads - 1);
-	}
+        uint64_t nowNS = GetTimeNS();
+        uint64_t nowTick = nowNS >> TIMER_WHEEL_TICK_NS_LOG2;
 
-    m_bHaveThreads = true;
-}
+        TimedTask* pTimedTask = m_pTimedTaskInbox->ReaderReadAll();
+        while( pTimedTask )
+        {
+            TimedTask* pNext = pTimedTask->pNext;
+            InsertTimedTask( pTimedTask, nowNS );
+            pTimedTask = pNext;
+        }
 
-void TaskScheduler::StopThreads( bool bWait_ )
-{
-    if( m_bHaveThreads )
-    {
-        // wait for them threads quit before deleting data
-        m_bRunning = false;
-        while( bWait_ && m_NumThreadsRunning )
+        if( AtomicLoad( &m_bTimedTaskStopRequested, MEMORY_ORDER_ACQUIRE ) )
         {
-            // keep firing event to ensure all threads pick up state of m_bRunning
-            EventSignal( m_NewTaskEvent );
+            // clear before checking, so a request after this is seen next time
+            AtomicStore( &m_bTimedTaskStopRequested, 0, MEMORY_ORDER_RELAXED );
+            BASE_MEMORYBARRIER_FULL();
+            for( uint32_t slot = 0; slot < TIMER_WHEEL_SIZE; ++slot )
+            {
+                TimedTask* volatile* ppTimedTask = &m_pTimerWheel[ slot ];
+                while( *ppTimedTask )
+                {
+                    pTimedTask = *ppTimedTask;
+                    if( AtomicLoad( &pTimedTask->m_bStopRequested, MEMORY_ORDER_RELAXED ) )
+                    {
+                        *ppTimedTask = pTimedTask->pNext;
+                        RemoveTimedTask( pTimedTask );
+                    }
+                    else
+                    {
+                        ppTimedTask = &pTimedTask->pNext;
+                    }
+                }
+            }
         }
 
-        for( uint32_t thread = 1; thread < m_NumThreads; ++thread )
+        // run due timers in the slots for the ticks since we last processed, a slot also holds
+        // timers for later revolutions of the wheel so check each deadline
+        uint64_t numTicks = nowTick - m_TimerWheelTick;
+        if( numTicks > TIMER_WHEEL_SIZE )
         {
-            ThreadTerminate( m_pThreadIDs[thread] );
+            numTicks = TIMER_WHEEL_SIZE;
+        }
+        for( uint64_t tick = nowTick + 1 - numTicks; tick <= nowTick; ++tick )
+        {
+            TimedTask* volatile* ppTimedTask = &m_pTimerWheel[ tick & ( TIMER_WHEEL_SIZE - 1 ) ];
+            while( *ppTimedTask )
+            {
+                pTimedTask = *ppTimedTask;
+                if( pTimedTask->m_DeadlineNS <= nowNS )
+                {
+                    *ppTimedTask = pTimedTask->pNext;
+                    RunTimedTask( pTimedTask, nowNS );
+                }
+                else
+                {
+                    ppTimedTask = &pTimedTask->pNext;
+                }
+            }
         }
+        // timers later in the current tick remain, so it is checked again next time
+        m_TimerWheelTick = nowTick - 1;
 
-		m_NumThreads = 0;
-        delete[] m_pThreadNumStore;
-        delete[] m_pThreadIDs;
-        m_pThreadNumStore = 0;
-        m_pThreadIDs = 0;
-        EventClose( m_NewTaskEvent );
+        // find the next deadline, checking slots in tick order until the earliest deadline
+        // found so far is no later than the tick being checked
+        uint64_t nextDeadlineNS = NO_DEADLINE;
+        for( uint64_t tick = nowTick; tick < nowTick + TIMER_WHEEL_SIZE; ++tick )
+        {
+            for( pTimedTask = m_pTimerWheel[ tick & ( TIMER_WHEEL_SIZE - 1 ) ]; pTimedTask; pTimedTask = pTimedTask->pNext )
+            {
+                if( pTimedTask->m_DeadlineNS < nextDeadlineNS )
+                {
+                    nextDeadlineNS = pTimedTask->m_DeadlineNS;
+                }
+            }
+            if( ( nextDeadlineNS >> TIMER_WHEEL_TICK_NS_LOG2 ) <= tick )
+            {
+                break;
+            }
+        }
+        AtomicStore( &m_TimedTaskNextDeadlineNS, nextDeadlineNS, MEMORY_ORDER_RELAXED );
 
-        m_bHaveThreads = false;
-		m_NumThreadsActive = 0;
-		m_NumThreadsRunning = 0;
+        // full barrier: timed tasks added or stopped after we read the inbox may have lowered
+        // the deadline before we wrote it, so process again to include them
+        BASE_MEMORYBARRIER_FULL();
+        bProcess = !m_pTimedTaskInbox->IsListEmpty() || AtomicLoad( &m_bTimedTaskStopRequested, MEMORY_ORDER_RELAXED );
     }
+
+    AtomicStore( &m_TimedTaskLock, 0, MEMORY_ORDER_RELEASE );
 }
 
-bool TaskScheduler::TryRunTask( uint32_t threadNum )
+void    TaskScheduler::InsertTimedTask( TimedTask* pTimedTask, uint64_t nowNS )
 {
-    // check for tasks
-    TaskSetInfo info;
-    bool bHaveTask = m_pPipesPerThread[ threadNum ].WriterTryReadFront( &info );
+    if( AtomicLoad( &pTimedTask->m_bStopRequested, MEMORY_ORDER_RELAXED ) )
+    {
+        RemoveTimedTask( pTimedTask );
+    }
+    else if( pTimedTask->m_DeadlineNS <= nowNS )
+    {
+        RunTimedTask( pTimedTask, nowNS );
+    }
+    else
+    {
+        TimedTask** ppSlot = &m_pTimerWheel[ ( pTimedTask->m_DeadlineNS >> TIMER_WHEEL_TICK_NS_LOG2 ) & ( TIMER_WHEEL_SIZE - 1 ) ];
+        pTimedTask->pNext = *ppSlot;
+        *ppSlot = pTimedTask;
+    }
+}
 
-    if( m_NumThreads )
+void    TaskScheduler::RunTimedTask( TimedTask* pTimedTask, uint64_t nowNS )
+{
+    if( AtomicLoad( &pTimedTask->m_bStopRequested, MEMORY_ORDER_RELAXED ) )
+    {
+        RemoveTimedTask( pTimedTask );
+        return;
+    }
+    ITaskSet* pTaskSet = pTimedTask->pTaskSet;
+    bool bAdd = pTaskSet->GetIsComplete();
+    if( pTimedTask->m_PeriodNS )
     {
-        uint32_t checkOtherThread = 0;
-        while( !bHaveTask && checkOtherThread < m_NumThreads )
+        // next deadline after now, skipping any periods missed whilst threads were busy
+        uint64_t periodNS = pTimedTask->m_PeriodNS;
+        uint64_t deadlineNS = pTimedTask->m_DeadlineNS + periodNS;
+        if( deadlineNS <= nowNS )
         {
-			if( checkOtherThread != threadNum )
-			{
-				bHaveTask = m_pPipesPerThread[ checkOtherThread ].ReaderTryReadBack( &info );
-			}
-            ++checkOtherThread;
+            deadlineNS += ( ( nowNS - deadlineNS ) / periodNS + 1 ) * periodNS;
+        }
+        pTimedTask->m_DeadlineNS = deadlineNS;
+        InsertTimedTask( pTimedTask, nowNS );
+        if( bAdd )
+        {
+            AddTaskSetToPipe( pTaskSet );
         }
     }
-        
-    if( bHaveTask )
+    else if( bAdd )
     {
-        // the task has already been divided up by AddTaskSetToPipe, so just run it
-        info.pTask->ExecuteRange( info.partition, threadNum );
-        AtomicAdd( &info.pTask->m_CompletionCount, -1 );
+        AddTaskSetToPipe( pTaskSet );
+        RemoveTimedTask( pTimedTask );
+    }
+    else
+    {
+        // one shot task set is still running from a previous add, retry next tick
+        pTimedTask->m_DeadlineNS = nowNS + ( (uint64_t)1 << TIMER_WHEEL_TICK_NS_LOG2 );
+        InsertTimedTask( pTimedTask, nowNS );
     }
-
-    return bHaveTask;
-
 }
 
-
-void    TaskScheduler::AddTaskSetToPipe( ITaskSet* pTaskSet )
+void    TaskScheduler::RemoveTimedTask( TimedTask* pTimedTask )
 {
-    TaskSetInfo info;
-    info.pTask = pTaskSet;
-    info.partition.start = 0;
-    info.partition.end = pTaskSet->m_SetSize;
-
-    // no one owns the task as yet, so just add to count
-    pTaskSet->m_CompletionCount = 0;
+    AtomicAdd( &m_NumTimedTasks, -1 );
+    AtomicStore( &pTimedTask->m_bActive, 0, MEMORY_ORDER_RELEASE );
+}
 
-    // divide task up and add to pipe
-    uint32_t numToRun = info.pTask->m_SetSize / m_NumPartitions;
-    if( numToRun == 0 ) { numToRun = 1; }
-    uint32_t rangeLeft = info.partition.end - info.partition.start ;
-    while( rangeLeft )
+void    TaskScheduler::ClearTimedTasks()
+{
+    TimedTask* pTimedTask = m_pTimedTaskInbox->ReaderReadAll();
+    while( pTimedTask )
     {
-        if( numToRun > rangeLeft )
-        {
-            numToRun = rangeLeft;
-        }
-        info.partition.start = pTaskSet->m_SetSize - rangeLeft;
-        info.partition.end = info.partition.start + numToRun;
-        rangeLeft -= numToRun;
-
-        // add the partition to the pipe
-        AtomicAdd( &info.pTask->m_CompletionCount, +1 );
-        if( !m_pPipesPerThread[ gtl_threadNum ].WriterTryWriteFront( info ) )
+        TimedTask* pNext = pTimedTask->pNext;
+        RemoveTimedTask( pTimedTask );
+        pTimedTask = pNext;
+    }
+    for( uint32_t slot = 0; slot < TIMER_WHEEL_SIZE; ++slot )
+    {
+        pTimedTask = m_pTimerWheel[ slot ];
+        while( pTimedTask )
         {
-			if( m_NumThreadsActive < m_NumThreadsRunning )
-			{
-				EventSignal( m_NewTaskEvent );
-			}
-            info.pTask->ExecuteRange( info.partition, gtl_threadNum );
-            --pTaskSet->m_CompletionCount;
+            TimedTask* pNext = pTimedTask->pNext;
+            RemoveTimedTask( pTimedTask );
+            pTimedTask = pNext;
         }
+        m_pTimerWheel[ slot ] = NULL;
     }
+    AtomicStore( &m_TimedTaskNextDeadlineNS, NO_DEADLINE, MEMORY_ORDER_RELAXED );
+}
 
-	if( m_NumThreadsActive < m_NumThreadsRunning )
-	{
-		EventSignal( m_NewTaskEvent );
-	}
-
+void    TaskScheduler::RunPinnedTasks()
+{
+	RunPinnedTasks( gtl_threadNum );
 }
 
-void    TaskScheduler::WaitforTaskSet( const ITaskSet* pTaskSet )
+void    TaskScheduler::RunPinnedTasks( uint32_t threadNum )
 {
-	if( pTaskSet )
+	IPinnedTask* pTask = m_pPinnedTaskListPerThread[ threadNum ].ReaderReadAll();
+	while( pTask )
 	{
-		while( pTaskSet->m_CompletionCount )
+		// get next before Execute, as once complete the task can be re-used
+		IPinnedTask* pNext = pTask->pNext;
+		pTask->Execute();
+		AtomicAdd( &pTask->m_RunningCount, -1 );
+
+		// The atomic decrement is a full barrier: either we see a waiting thread, or it sees
+		// the task is complete, see WaitForPinnedTaskCompletion. pTask is only used for
+		// comparison from here, as it may already have been re-used or deleted.
+		if( AtomicLoad( &m_NumThreadsWaitingForPinnedTasks ) )
 		{
-			TryRunTask( gtl_threadNum );
-			// should add a spin then wait for task completion event.
+			WakeThreadsWaitingForPinnedTask( pTask );
 		}
-	}
-	else
-	{
-			TryRunTask( gtl_threadNum );
+		pTask = pNext;
 	}
 }
 
 void    TaskScheduler::WaitforAll()
 {
     bool bHaveTasks = true;
-    while( bHaveTasks || m_NumThreadsActive)
+    while( bHaveTasks || AtomicLoad( &m_NumThreadsActive ) || AtomicLoad( &m_NumNumaInboxTaskSets ) )
     {
+        RunPinnedTasks( gtl_threadNum );
         TryRunTask( gtl_threadNum );
-        bHaveTasks = false;
+        bHaveTasks = HaveTasks( gtl_threadNum );
+        for( uint32_t thread = 0; !bHaveTasks && thread < m_NumThreads; ++thread )
+        {
+            bHaveTasks = !m_pPinnedTaskListPerThread[ thread ].IsListEmpty();
+        }
+     }
+}
+
+bool    TaskScheduler::HaveTasks( uint32_t threadNum ) const
+{
+    if( AtomicLoad( &m_NumDeadlineTaskSets ) || !m_pPinnedTaskListPerThread[ threadNum ].IsListEmpty() )
+    {
+        return true;
+    }
+    if( m_pFibers && GetReadyParkedFiber( threadNum ) )
+    {
+        return true;
+    }
+    if( AtomicLoad( &m_NumNumaInboxTaskSets ) &&
+        !m_pTaskSetInboxPerNumaNode[ m_pThreadDataStore[ threadNum ].numaNode ].IsListEmpty() )
+    {
+        return true;
+    }
+
+    for( int priority = 0; priority < TASK_PRIORITY_NUM; ++priority )
+    {
         for( uint32_t thread = 0; thread < m_NumThreads; ++thread )
         {
-            if( !m_pPipesPerThread[ thread ].IsPipeEmpty() )
+            if( !m_pPipesPerThread[ thread ][ priority ].IsPipeEmpty() )
             {
-                bHaveTasks = true;
-                break;
+                return true;
             }
         }
-     }
+    }
+    return false;
 }
 
 void    TaskScheduler::WaitforAllAndShutdown()
 {
     WaitforAll();
     StopThreads(true);
-	delete[] m_pPipesPerThread;
-    m_pPipesPerThread = 0;
+    DeletePipes();
 }
 
 uint32_t        TaskScheduler::GetNumTaskThreads() const
@@ -289,41 +2050,237 @@ uint32_t        TaskScheduler::GetNumTaskThreads() const
     return m_NumThreads;
 }
 
+void            TaskScheduler::SetNumActiveThreads( uint32_t numActiveThreads_ )
+{
+    assert( numActiveThreads_ >= 1 && numActiveThreads_ <= m_Config.numThreads );
+    uint32_t prevNumActiveThreads = AtomicLoad( &m_NumActiveThreads, MEMORY_ORDER_RELAXED );
+    AtomicStore( &m_NumActiveThreads, numActiveThreads_, MEMORY_ORDER_RELAXED );
+    SetNumPartitions( numActiveThreads_ );
+
+    // full barrier: either we see parked threads sleeping, or they see they are active, see WaitWhileParked.
+    // Threads being parked finish their current task, and any sleeping are left to sleep.
+    BASE_MEMORYBARRIER_FULL();
+    for( uint32_t thread = prevNumActiveThreads; thread < numActiveThreads_; ++thread )
+    {
+        WakeThread( thread );
+    }
+}
+
+uint32_t        TaskScheduler::GetNumActiveThreads() const
+{
+    return AtomicLoad( &m_NumActiveThreads, MEMORY_ORDER_RELAXED );
+}
+
+uint32_t        TaskScheduler::GetNumPinnedThreads() const
+{
+    return m_NumPinnedThreads;
+}
+
+bool            TaskScheduler::RegisterExternalThread()
+{
+    // thread 0, task threads and registered external threads already have their own slot
+    if( 0 != gtl_threadNum || m_pThread0ThreadNum == &gtl_threadNum )
+    {
+        assert( !"RegisterExternalThread: thread already has a slot" );
+        return false;
+    }
+    for( uint32_t thread = m_Config.numThreads; thread < m_NumThreads; ++thread )
+    {
+        ThreadDataStore& threadData = m_pThreadDataStore[ thread ];
+        if( !AtomicLoad( &threadData.bExternalThreadRegistered, MEMORY_ORDER_RELAXED ) &&
+            0 == AtomicCompareAndSwap( &threadData.bExternalThreadRegistered, 1, 0 ) )
+        {
+            gtl_threadNum = thread;
+            AtomicAdd( &m_NumExternalThreadsRegistered, 1, MEMORY_ORDER_RELAXED );
+            UpdateCacheGroup( thread );
+            AtomicStore( &threadData.numaNode, GetCurrentNumaNode(), MEMORY_ORDER_RELAXED );
+            return true;
+        }
+    }
+    return false;
+}
+
+void            TaskScheduler::DeregisterExternalThread()
+{
+    uint32_t threadNum = gtl_threadNum;
+    assert( threadNum >= m_Config.numThreads && threadNum < m_NumThreads );
+
+    // pinned tasks for this slot would not run until it is registered again
+    RunPinnedTasks( threadNum );
+    gtl_threadNum = 0;
+    AtomicAdd( &m_NumExternalThreadsRegistered, -1, MEMORY_ORDER_RELAXED );
+
+    // full barrier, so the next thread to take the slot sees our writes to its pipes
+    AtomicCompareAndSwap( &m_pThreadDataStore[ threadNum ].bExternalThreadRegistered, 0, 1 );
+}
+
 TaskScheduler::TaskScheduler()
 		: m_pPipesPerThread(NULL)
+		, m_pPinnedTaskListPerThread(NULL)
 		, m_NumThreads(0)
 		, m_pThreadNumStore(NULL)
+		, m_pThreadDataStore(NULL)
 		, m_pThreadIDs(NULL)
 		, m_bRunning(false)
 		, m_NumThreadsRunning(0)
 		, m_NumThreadsActive(0)
+		, m_NumThreadsSleeping(0)
+		, m_NumThreadsWaitingForTaskSets(0)
+		, m_NumThreadsWaitingForPinnedTasks(0)
+		, m_NumActiveThreads(0)
+		, m_NumExternalThreadsRegistered(0)
+		, m_pThread0ThreadNum(NULL)
 		, m_NumPartitions(0)
+		, m_AutoPartitionTargetCycles(0)
+		, m_pTaskPool(NULL)
+		, m_pTaskPoolMemory(NULL)
+		, m_pCacheGroupPerCPU(NULL)
+		, m_NumCPUs(0)
 		, m_bHaveThreads(false)
+		, m_pTimedTaskInbox(NULL)
+		, m_pTimerWheel(NULL)
+		, m_TimerWheelTick(0)
+		, m_TimedTaskLock(0)
+		, m_NumTimedTasks(0)
+		, m_bTimedTaskStopRequested(0)
+		, m_TimedTaskNextDeadlineNS(NO_DEADLINE)
+		, m_TimerSleepThread(NO_THREAD)
+		, m_TimerSleepUntilNS(NO_DEADLINE)
+		, m_pDeadlineHeap(NULL)
+		, m_DeadlineHeapSize(0)
+		, m_DeadlineHeapCapacity(0)
+		, m_NumDeadlineTaskSetsAdded(0)
+		, m_DeadlineTaskSetsLock(0)
+		, m_NumDeadlineTaskSets(0)
+		, m_pFibers(NULL)
+		, m_NumParkedFibers(0)
+		, m_pNumaNodePerCPU(NULL)
+		, m_NumNumaNodes(0)
+		, m_pNumThreadsPerNumaNode(NULL)
+		, m_pTaskSetInboxPerNumaNode(NULL)
+		, m_NumNumaInboxTaskSets(0)
+		, m_NumThreadsStarting(0)
+		, m_NumPinnedThreads(0)
+		, m_NumDeadlineTaskSetsRun(0)
+		, m_NumDeadlineMisses(0)
 {
 }
 
 TaskScheduler::~TaskScheduler()
 {
     StopThreads( true ); // Stops threads, waiting for them.
+    DeletePipes();
+}
 
+void    TaskScheduler::DeletePipes()
+{
+    // m_NumThreads is cleared by StopThreads
+    uint32_t numThreads = m_Config.numThreads + m_Config.numExternalThreads;
+    for( uint32_t thread = 0; m_pPipesPerThread && thread < numThreads; ++thread )
+    {
+        delete[] m_pPipesPerThread[ thread ];
+    }
     delete[] m_pPipesPerThread;
-    m_pPipesPerThread = 0;
+    m_pPipesPerThread = NULL;
+    delete[] m_pPinnedTaskListPerThread;
+    m_pPinnedTaskListPerThread = NULL;
 }
 
-void    TaskScheduler::Initialize( uint32_t numThreads_ )
+void    TaskScheduler::Initialize( TaskSchedulerConfig config_ )
 {
-	assert( numThreads_ );
     StopThreads( true ); // Stops threads, waiting for them.
-    delete[] m_pPipesPerThread;
+    DeletePipes();
+
+	if( 0 == config_.numThreads )
+	{
+		// not GetNumHardwareThreads(), as containers often have fewer CPUs than the machine
+		config_.numThreads = GetCPUResources().numUsableCPUs;
+	}
+	if( 0 == config_.pipeCapacity )
+	{
+		config_.pipeCapacity = 1 << PIPESIZE_LOG2;
+	}
+	if( 0 == config_.pooledTaskSetsPerThread )
+	{
+		config_.pooledTaskSetsPerThread = POOLED_TASK_SETS_PER_THREAD;
+	}
+	if( 0 == config_.fibersPerThread )
+	{
+		config_.fibersPerThread = FIBERS_PER_THREAD;
+	}
+	if( 0 == config_.fiberStackSize )
+	{
+		config_.fiberStackSize = FIBER_STACK_SIZE;
+	}
+	m_Config = config_;
+	m_NumThreads = m_Config.numThreads + m_Config.numExternalThreads;
 
-	m_NumThreads = numThreads_;
+	m_AutoPartitionTargetCycles = 0;
+	if( m_Config.autoPartitionTargetNS )
+	{
+		// calibrate the cycle counter against the monotonic clock
+		uint64_t startNS     = GetTimeNS();
+		uint64_t startCycles = GetCycleCount();
+		uint64_t elapsedNS   = 0;
+		while( elapsedNS < 200000 )
+		{
+			elapsedNS = GetTimeNS() - startNS;
+		}
+		double cyclesPerNS = (double)( GetCycleCount() - startCycles ) / (double)elapsedNS;
+		m_AutoPartitionTargetCycles = (uint64_t)( cyclesPerNS * m_Config.autoPartitionTargetNS );
+		if( 0 == m_AutoPartitionTargetCycles ) { m_AutoPartitionTargetCycles = 1; }
+	}
 
-    m_pPipesPerThread = new TaskPipe[ m_NumThreads ];
+    // each thread's pipes are allocated by StartThreads, see AllocateThreadMemory
+    m_pPipesPerThread = new TaskPipe*[ m_NumThreads ];
+    for( uint32_t thread = 0; thread < m_NumThreads; ++thread )
+    {
+        m_pPipesPerThread[ thread ] = NULL;
+    }
+    m_pPinnedTaskListPerThread = new PinnedTaskList[ m_NumThreads ];
 
     StartThreads();
 }
 
+void    TaskScheduler::Initialize( uint32_t numThreads_ )
+{
+	assert( numThreads_ );
+	TaskSchedulerConfig config;
+	config.numThreads = numThreads_;
+	Initialize( config );
+}
+
 void   TaskScheduler::Initialize()
 {
-	Initialize( GetNumHardwareThreads() );
-}
\ No newline at end of file
+	Initialize( TaskSchedulerConfig() );
+}
+
+TaskSchedulerConfig TaskScheduler::GetConfig() const
+{
+	return m_Config;
+}
+
+TaskSchedulerStats TaskScheduler::GetStats() const
+{
+	TaskSchedulerStats stats;
+	for( uint32_t thread = 0; m_pThreadDataStore && thread < m_NumThreads; ++thread )
+	{
+		const TaskSchedulerStats& threadStats = m_pThreadDataStore[ thread ].stats;
+		stats.numPartitionsRun += threadStats.numPartitionsRun;
+		stats.numStealAttempts += threadStats.numStealAttempts;
+		stats.numSteals        += threadStats.numSteals;
+	}
+	stats.numDeadlineTaskSetsRun = (uint64_t)AtomicLoad( &m_NumDeadlineTaskSetsRun, MEMORY_ORDER_RELAXED );
+	stats.numDeadlineMisses      = (uint64_t)AtomicLoad( &m_NumDeadlineMisses, MEMORY_ORDER_RELAXED );
+	return stats;
+}
+
+void TaskScheduler::ResetStats()
+{
+	for( uint32_t thread = 0; m_pThreadDataStore && thread < m_NumThreads; ++thread )
+	{
+		m_pThreadDataStore[ thread ].stats = TaskSchedulerStats();
+	}
+	AtomicStore( &m_NumDeadlineTaskSetsRun, 0, MEMORY_ORDER_RELAXED );
+	AtomicStore( &m_NumDeadlineMisses, 0, MEMORY_ORDER_RELAXED );
+}
@@ -19,6 +19,7 @@
 #pragma once
 
 #include <stdint.h>
+#include <new>
 #include "Threads.h"
 
 namespace enki
@@ -30,9 +31,63 @@ namespace enki
 		uint32_t end;
 	};
 
+	// Task priorities, higher priority tasks are run before lower priority tasks
+	// from both a thread's own pipe and those it steals from.
+	enum TaskPriority
+	{
+		TASK_PRIORITY_HIGH,
+		TASK_PRIORITY_MED,
+		TASK_PRIORITY_LOW,
+		TASK_PRIORITY_NUM
+	};
+
+	// For ITaskSet::m_PreferredNumaNode when any node can run the task set
+	static const uint32_t NUMA_NODE_ANY = 0xFFFFFFFF;
+
+	// How AddTaskSetToPipe divides task sets into partitions, see TaskSchedulerConfig::partitionMode
+	enum TaskPartitionMode
+	{
+		// Divide task sets up front into partitions of m_SetSize / ( N * (N-1) ) for N threads,
+		// and add them all to the pipe.
+		TASK_PARTITION_MODE_EAGER,
+
+		// Add task sets to the pipe as one partition. Whilst running a partition, a thread
+		// splits off the upper half of what remains and adds it to its pipe whenever its pipe
+		// is empty, so other threads can steal it. Partitions are not split smaller than in
+		// eager mode. Small sets need few pipe writes, and large sets still balance.
+		TASK_PARTITION_MODE_LAZY_SPLIT,
+	};
+
 	class  TaskScheduler;
 	class  TaskPipe;
+	struct TaskPoolSlot;
+	class  PinnedTaskList;
+	class  TimedTaskList;
+	class  TaskSetList;
+	class  ITaskSet;
 	struct ThreadArgs;
+	struct ThreadDataStore;
+	struct Fiber;
+	struct DeadlineTaskSet;
+
+	// Dependency - when pDependencyTask completes, pTaskToRunOnCompletion is added to the pipe
+	// once all of its other dependencies have also completed.
+	// Dependencies are owned by the user so no allocations occur, set them with
+	// ITaskSet::SetDependency. A Dependency clears itself on destruction.
+	struct Dependency
+	{
+		Dependency();
+		Dependency( ITaskSet* pDependencyTask_, ITaskSet* pTaskToRunOnCompletion_ );
+		~Dependency();
+
+		ITaskSet*               pDependencyTask;
+		ITaskSet*               pTaskToRunOnCompletion;
+		Dependency*             pNext;
+
+	private:
+		Dependency( const Dependency& nocopy );
+		Dependency& operator=( const Dependency& nocopy );
+	};
 
 	// Subclass ITaskSet to create tasks.
 	// TaskSets can be re-used, but check
@@ -40,13 +95,41 @@ namespace enki
 	{
 	public:
 		ITaskSet()
-			: m_CompletionCount(0)
-			, m_SetSize(1)
+			: m_SetSize(1)
+			, m_MinRange(1)
+			, m_MaxPartitions(0)
+			, m_Priority(TASK_PRIORITY_MED)
+			, m_DeadlineNS(0)
+			, m_PreferredNumaNode(NUMA_NODE_ANY)
+			, m_CompletionCount(0)
+			, m_pDependents(NULL)
+			, m_DependenciesCount(0)
+			, m_DependenciesCompletedCount(0)
+			, m_CyclesPerElement(0.0f)
+			, m_bCancelled(false)
+			, m_DeadlineRangeStart(0)
+			, m_pCompletionFunction(NULL)
+			, m_pCompletionArg(NULL)
+			, pNext(NULL)
 		{}
 
 		ITaskSet( uint32_t setSize_ )
-			: m_CompletionCount(0)
-			, m_SetSize( setSize_ )
+			: m_SetSize( setSize_ )
+			, m_MinRange(1)
+			, m_MaxPartitions(0)
+			, m_Priority(TASK_PRIORITY_MED)
+			, m_DeadlineNS(0)
+			, m_PreferredNumaNode(NUMA_NODE_ANY)
+			, m_CompletionCount(0)
+			, m_pDependents(NULL)
+			, m_DependenciesCount(0)
+			, m_DependenciesCompletedCount(0)
+			, m_CyclesPerElement(0.0f)
+			, m_bCancelled(false)
+			, m_DeadlineRangeStart(0)
+			, m_pCompletionFunction(NULL)
+			, m_pCompletionArg(NULL)
+			, pNext(NULL)
 		{}
 		// Execute range should be overloaded to process tasks. It will be called with a
 		// range_ where range.start >= 0; range.start < range.end; and range.end < m_SetSize;
@@ -59,26 +142,336 @@ namespace enki
 		// Size of set - usually the number of data items to be processed, see ExecuteRange. Defaults to 1
 		uint32_t                m_SetSize;
 
+		// Minimum size of range passed to ExecuteRange, except for the last range of a set.
+		// Set this so that each range does enough work to outweigh the scheduling overhead. Defaults to 1
+		uint32_t                m_MinRange;
+
+		// Maximum number of partitions the set is divided into, 0 for no limit. Defaults to 0
+		uint32_t                m_MaxPartitions;
+
+		// Priority of the task set, only read by AddTaskSetToPipe. Defaults to TASK_PRIORITY_MED
+		TaskPriority            m_Priority;
+
+		// Time the task set should be complete by, in GetTimeNS() time, or 0 for none. Task sets with
+		// a deadline are run before those without, earliest deadline first, from a queue shared by
+		// all threads. Completing after the deadline counts as a miss in TaskSchedulerStats.
+		// Only read by AddTaskSetToPipe and on completion. Defaults to 0
+		uint64_t                m_DeadlineNS;
+
+		// NUMA node whose threads should run the task set, for work on data allocated on that node.
+		// With TaskSchedulerConfig::numaAware, task sets added from a thread on another node are passed
+		// to the node to be divided into partitions there. Only read by AddTaskSetToPipe.
+		// Defaults to NUMA_NODE_ANY
+		uint32_t                m_PreferredNumaNode;
+
 		bool                    GetIsComplete()
 		{
-			return 0 == m_CompletionCount;
+			return 0 == AtomicLoad( &m_CompletionCount, MEMORY_ORDER_ACQUIRE );
+		}
+
+		// Cancel stops a task set which has been added from running any more partitions. Partitions
+		// not yet started are skipped, but still completed, so the task set completes and launches
+		// its dependents as usual. Long running ExecuteRange calls can poll GetIsCancelled to return early.
+		// Can be called from any thread. Cleared when the task set is next added, or for task sets
+		// with dependencies when they become pending, so pending task sets can be cancelled.
+		void                    Cancel()
+		{
+			AtomicStore( &m_bCancelled, true, MEMORY_ORDER_RELAXED );
 		}
+
+		bool                    GetIsCancelled() const
+		{
+			return AtomicLoad( &m_bCancelled, MEMORY_ORDER_RELAXED );
+		}
+
+		// SetCompletionFunction sets pFunc_( pArg_ ) to be called once by the thread which completes
+		// the task set, after waiting threads are woken and dependents launched, and is then cleared.
+		// The task set may already have been re-used or deleted when it is called, so only use pArg_.
+		// Set before AddTaskSetToPipe. Used by TaskSchedulerCoroutine.h to resume coroutines.
+		typedef void (*CompletionFunction)( void* pArg_ );
+		void                    SetCompletionFunction( CompletionFunction pFunc_, void* pArg_ )
+		{
+			m_pCompletionFunction = pFunc_;
+			m_pCompletionArg      = pArg_;
+		}
+
+		// SetDependency makes this task run after pDependencyTask_ completes, using dependency_ to
+		// store the link. Tasks with dependencies are added to the pipe automatically when all their
+		// dependencies complete, so only add tasks without dependencies with AddTaskSetToPipe.
+		// Dependent tasks are marked as not complete when a task they depend on is added, so
+		// waiting on the final task of a graph after adding the first tasks is safe.
+		// A task can have many dependencies, and be a dependency of many tasks.
+		// Not thread safe - only change dependencies when none of the tasks involved are running.
+		void                    SetDependency( Dependency& dependency_, ITaskSet* pDependencyTask_ );
+
+		// ClearDependency removes a dependency set with SetDependency, same restrictions apply.
+		void                    ClearDependency( Dependency& dependency_ );
+
 	private:
 		friend class           TaskScheduler;
+		friend struct          Dependency;
+		friend class           Coroutine;      // see TaskSchedulerCoroutine.h
 		volatile int32_t        m_CompletionCount;
+		Dependency*             m_pDependents;
+		int32_t                 m_DependenciesCount;
+		volatile int32_t        m_DependenciesCompletedCount;
+		volatile float          m_CyclesPerElement; // see TaskSchedulerConfig::autoPartitionTargetNS
+		volatile bool           m_bCancelled;
+		uint32_t                m_DeadlineRangeStart; // see TaskScheduler::TryRunDeadlineTask
+		CompletionFunction      m_pCompletionFunction;
+		void*                   m_pCompletionArg;
+		template<typename T> friend class LockLessMultiWriteIntrusiveList;
+		ITaskSet* volatile      pNext;                  // see TaskScheduler::TryAddNumaTaskSets
 	};
 
 
+	// Subclass IPinnedTask to create tasks which must run on a given thread.
+	// Thread 0 is the thread which called Initialize, so it runs pinned tasks when it calls
+	// WaitforTaskSet, WaitforAll or RunPinnedTasks. Task threads run them between task sets.
+	class IPinnedTask
+	{
+	public:
+		IPinnedTask()
+			: threadNum(0)
+			, m_RunningCount(0)
+			, pNext(NULL)
+		{}
+
+		IPinnedTask( uint32_t threadNum_ )
+			: threadNum( threadNum_ )
+			, m_RunningCount(0)
+			, pNext(NULL)
+		{}
+
+		// Execute is called once on thread threadNum
+		virtual void            Execute() = 0;
+
+		// Thread to run this pinned task on, must be < GetNumTaskThreads(). Defaults to 0
+		uint32_t                threadNum;
+
+		bool                    GetIsComplete() const
+		{
+			return 0 == AtomicLoad( &m_RunningCount, MEMORY_ORDER_ACQUIRE );
+		}
+
+	private:
+		friend class           TaskScheduler;
+		template<typename T> friend class LockLessMultiWriteIntrusiveList;
+		volatile int32_t        m_RunningCount;
+		IPinnedTask* volatile   pNext;
+	};
+
+	// TimedTask - adds pTaskSet to the pipe after a delay, and optionally every period after that,
+	// see TaskScheduler::AddTimedTask. Owned by the user so no allocations occur.
+	// Must not be destroyed or re-added whilst GetIsActive().
+	class TimedTask
+	{
+	public:
+		TimedTask()
+			: pTaskSet(NULL)
+			, m_DeadlineNS(0)
+			, m_PeriodNS(0)
+			, m_bActive(0)
+			, m_bStopRequested(0)
+			, pNext(NULL)
+		{}
+
+		TimedTask( ITaskSet* pTaskSet_ )
+			: pTaskSet( pTaskSet_ )
+			, m_DeadlineNS(0)
+			, m_PeriodNS(0)
+			, m_bActive(0)
+			, m_bStopRequested(0)
+			, pNext(NULL)
+		{}
+
+		// Task set to add, should not have dependencies
+		ITaskSet*               pTaskSet;
+
+		// True from AddTimedTask until a one shot task has been added to the pipe, or a
+		// periodic task has been removed by StopTimedTask or shutdown
+		bool                    GetIsActive() const
+		{
+			return 0 != AtomicLoad( &m_bActive, MEMORY_ORDER_ACQUIRE );
+		}
+
+	private:
+		friend class           TaskScheduler;
+		template<typename T> friend class LockLessMultiWriteIntrusiveList;
+		uint64_t                m_DeadlineNS;
+		uint64_t                m_PeriodNS;
+		volatile int32_t        m_bActive;
+		volatile int32_t        m_bStopRequested;
+		TimedTask* volatile     pNext;
+	};
+
+	// TaskSet<F> - task set which calls a functor or lambda, stored in the task set so
+	// there is no allocation and the call can be inlined into ExecuteRange. F must be callable as
+	// func_( TaskSetPartition range, uint32_t threadnum ). Use MakeTaskSet to deduce F:
+	//   auto task = enki::MakeTaskSet( setSize, []( enki::TaskSetPartition range, uint32_t threadnum ) { ... } );
+	template<typename F> class TaskSet : public ITaskSet
+	{
+	public:
+		TaskSet( uint32_t setSize_, const F& func_ )
+			: ITaskSet( setSize_ )
+			, m_Func( func_ )
+		{}
+
+		virtual void            ExecuteRange( TaskSetPartition range, uint32_t threadnum )
+		{
+			m_Func( range, threadnum );
+		}
+
+		F                       m_Func;
+	};
+
+	template<typename F> inline TaskSet<F> MakeTaskSet( uint32_t setSize_, const F& func_ )
+	{
+		return TaskSet<F>( setSize_, func_ );
+	}
+
+	// ParallelForTaskSet<F> - task set which calls func_( index ) for each index in [begin_, end_),
+	// with the loop inside ExecuteRange so the body can be inlined. See TaskScheduler::ParallelFor
+	template<typename F> class ParallelForTaskSet : public ITaskSet
+	{
+	public:
+		ParallelForTaskSet( uint32_t begin_, uint32_t end_, const F& func_ )
+			: ITaskSet( end_ > begin_ ? end_ - begin_ : 0 )
+			, m_Begin( begin_ )
+			, m_Func( func_ )
+		{}
+
+		virtual void            ExecuteRange( TaskSetPartition range, uint32_t )
+		{
+			uint32_t end = m_Begin + range.end;
+			for( uint32_t index = m_Begin + range.start; index < end; ++index )
+			{
+				m_Func( index );
+			}
+		}
+
+		uint32_t                m_Begin;
+		F                       m_Func;
+	};
+
+	// TaskSchedulerConfig - configuration passed to TaskScheduler::Initialize( config_ )
+	// default constructed values are the same as used by Initialize()
+	struct TaskSchedulerConfig
+	{
+		TaskSchedulerConfig()
+			: numThreads(0)
+			, numExternalThreads(0)
+			, pipeCapacity(0)
+			, pooledTaskSetsPerThread(0)
+			, stealFromSharedCacheFirst(false)
+			, numaAware(false)
+			, pinThreadsToCPUs(false)
+			, pThreadCPUs(NULL)
+			, numThreadCPUs(0)
+			, partitionMode(TASK_PARTITION_MODE_EAGER)
+			, autoPartitionTargetNS(0)
+			, useFibers(false)
+			, fibersPerThread(0)
+			, fiberStackSize(0)
+		{}
+
+		// Number of threads including the thread which calls Initialize, which is thread 0.
+		// 0 uses GetCPUResources().numUsableCPUs, which respects the affinity mask and cgroup CPU quota
+		uint32_t                numThreads;
+
+		// Number of thread slots reserved for threads not created by the scheduler, see
+		// TaskScheduler::RegisterExternalThread. Each slot has its own pipes, and external
+		// thread numbers follow those of the scheduler's threads. Defaults to 0.
+		uint32_t                numExternalThreads;
+
+		// Number of task partitions each thread's pipe for each priority can hold before it needs to allocate.
+		// Pipes grow when full so tasks are never run on the adding thread, this sets
+		// how much is allocated up front. 0 uses the default of 256.
+		uint32_t                pipeCapacity;
+
+		// Number of task sets each thread can have in flight with AddTaskSetFireAndForget.
+		// Each uses a fixed size slot allocated at Initialize. 0 uses the default of 256.
+		uint32_t                pooledTaskSetsPerThread;
+
+		// When stealing tasks, first try threads currently running on CPUs which share
+		// the last level cache (L3 / CCX) with the stealing thread. Unless threads are pinned,
+		// see pinThreadsToCPUs, the CPU is sampled when a thread starts and after it sleeps. Linux only.
+		bool                    stealFromSharedCacheFirst;
+
+		// Allocate each task thread's pipes and pooled task sets from the thread itself, so they are on
+		// its NUMA node, steal from threads on the same node before other nodes, and run task sets
+		// with ITaskSet::m_PreferredNumaNode on that node. A thread's node is read when it starts,
+		// so use with pinThreadsToCPUs. Linux and Windows only. Defaults to false.
+		bool                    numaAware;
+
+		// Pin each thread created by the scheduler to one CPU, so it keeps its caches warm.
+		// Thread 0 and external threads are not pinned. Linux and Windows only. Defaults to false.
+		bool                    pinThreadsToCPUs;
+
+		// CPUs to pin threads to when pinThreadsToCPUs is set, thread 1 is pinned to pThreadCPUs[0]
+		// and so on, wrapping around if there are fewer CPUs than threads. Only read by Initialize.
+		// NULL (the default) uses every CPU in the process affinity mask, one per physical core before
+		// their SMT siblings. A thread whose CPU cannot be used runs unpinned, see GetNumPinnedThreads.
+		const uint32_t*         pThreadCPUs;
+		uint32_t                numThreadCPUs;
+
+		// How task sets are divided into partitions. Defaults to TASK_PARTITION_MODE_EAGER
+		TaskPartitionMode       partitionMode;
+
+		// When non zero, the time taken per element is measured each time a task set runs, and
+		// partitions are sized to take this long on the next run, rather than m_SetSize / ( N * (N-1) ).
+		// m_MinRange and m_MaxPartitions still apply. Around 50000 (50us) keeps scheduling overhead low.
+		// 0 (the default) disables this.
+		uint32_t                autoPartitionTargetNS;
+
+		// When a task calls WaitforTaskSet, park the task's fiber and run other tasks on a fresh
+		// fiber from the thread's pool, rather than on top of the waiting task's stack. The parked
+		// fiber is resumed on the same thread once the task set completes. If the pool is empty,
+		// or on thread 0, the wait runs tasks on the current stack as usual. Defaults to false.
+		bool                    useFibers;
+
+		// Fibers in each thread's pool when useFibers is set. 0 uses the default of 16.
+		uint32_t                fibersPerThread;
+
+		// Stack size of each fiber in bytes when useFibers is set. 0 uses the default of 256KB.
+		uint32_t                fiberStackSize;
+	};
+
+	// TaskSchedulerStats - counts summed over all threads, see TaskScheduler::GetStats()
+	struct TaskSchedulerStats
+	{
+		TaskSchedulerStats()
+			: numPartitionsRun(0)
+			, numStealAttempts(0)
+			, numSteals(0)
+			, numDeadlineTaskSetsRun(0)
+			, numDeadlineMisses(0)
+		{}
+
+		// Task set partitions run by all threads
+		uint64_t                numPartitionsRun;
+
+		// Attempts to take a task from another thread's pipe which was not empty
+		uint64_t                numStealAttempts;
+
+		// Attempts which succeeded, the rest lost a race with another thread
+		uint64_t                numSteals;
+
+		// Task sets with ITaskSet::m_DeadlineNS completed, and those which completed after it
+		uint64_t                numDeadlineTaskSetsRun;
+		uint64_t                numDeadlineMisses;
+	};
+
 	class TaskScheduler
 	{
 	public:
 		TaskScheduler();
 		~TaskScheduler();
 
-		// Call either Initialize() or Initialize( numThreads_ ) before adding tasks.
+		// Call either Initialize(), Initialize( numThreads_ ) or Initialize( config_ ) before adding tasks.
 
-		// Initialize() will create GetNumHardwareThreads()-1 threads, which is
-		// sufficient to fill the system when including the main thread.
+		// Initialize() will create GetCPUResources().numUsableCPUs-1 threads, which is
+		// sufficient to fill the CPUs available to the process when including the main thread.
 		// Initialize can be called multiple times - it will wait for completion
 		// before re-initializing.
 		void			Initialize();
@@ -88,13 +481,62 @@ namespace enki
 		// the thread on which the initialize was called.
 		void			Initialize( uint32_t numThreads_ );
 
+		// Initialize( config_ ) - see TaskSchedulerConfig
+		void			Initialize( TaskSchedulerConfig config_ );
 
-		// Adds the TaskSet to pipe and returns if the pipe is not full.
-		// If the pipe is full, pTaskSet is run.
+		// Returns the config in use, with defaults resolved.
+		TaskSchedulerConfig GetConfig() const;
+
+		// Returns stats summed over all threads since Initialize or ResetStats.
+		// Counts are not synchronized, so are approximate whilst tasks are running.
+		TaskSchedulerStats GetStats() const;
+		void               ResetStats();
+
+
+		// Adds the TaskSet to pipe and returns.
+		// If the pipe is full it grows, see TaskSchedulerConfig::pipeCapacity.
 		// should only be called from main thread, or within a task
 		void            AddTaskSetToPipe( ITaskSet* pTaskSet );
 
+		// Maximum size of a task set added with AddTaskSetFireAndForget
+		static const uint32_t   POOLED_TASK_SET_MAX_SIZE = 240;
+
+		// Adds a TaskSet<F> calling func_ ( see TaskSet<F> ) which the scheduler owns and recycles
+		// once complete, so the caller does not need to keep it. The task set is constructed in the
+		// calling thread's fixed size pool, so there is no allocation. Returns false, and does not add
+		// the task set, if the pool is exhausted, see TaskSchedulerConfig::pooledTaskSetsPerThread.
+		// sizeof( TaskSet<F> ) must be <= POOLED_TASK_SET_MAX_SIZE, so capture large data by pointer.
+		// Can be called from any thread which can call AddTaskSetToPipe.
+		template<typename F>
+		bool            AddTaskSetFireAndForget( uint32_t setSize_, const F& func_, TaskPriority priority_ = TASK_PRIORITY_MED );
+
+		// Adds the pinned task to the pinned task list of thread pTask_->threadNum and returns.
+		// Can be called from any thread which can call AddTaskSetToPipe. Returns false, and asserts,
+		// if pTask_->threadNum is an external thread slot which is not registered.
+		bool            AddPinnedTask( IPinnedTask* pTask_ );
+
+		// Adds pTimedTask_->pTaskSet to the pipe once delayNS_ has passed, and if periodNS_ is non zero
+		// again every periodNS_ after that until StopTimedTask. Timers are kept in a timer wheel
+		// with a resolution of around 1ms, and are checked by task threads between partitions, so a
+		// busy scheduler may add the task set late by the length of a partition. Idle threads sleep
+		// until the next deadline, so no timer thread is needed. A period is skipped if the task set
+		// has not completed since it was last added. Can be called from any thread.
+		void            AddTimedTask( TimedTask* pTimedTask_, uint64_t delayNS_, uint64_t periodNS_ = 0 );
+
+		// Removes a timed task before it is next added to the pipe. It is removed asynchronously,
+		// wait for pTimedTask_->GetIsActive() to be false before destroying or re-adding it.
+		void            StopTimedTask( TimedTask* pTimedTask_ );
+
+		// Runs the pinned tasks for the calling thread. Thread 0 only runs pinned tasks
+		// when it calls this or one of the Waitfor functions.
+		void            RunPinnedTasks();
+
+		// Runs tasks until true == pTask_->GetIsComplete();
+		// same restrictions as WaitforTaskSet.
+		void            WaitforPinnedTask( const IPinnedTask* pTask_ );
+
 		// Runs the TaskSets in pipe until true == pTaskSet->GetIsComplete();
+		// If no tasks are available it spins for a while, then sleeps until the task set completes.
 		// should only be called from thread which created the taskscheduler , or within a task
 		// if called with 0 it will try to run tasks, and return if none available.
 		void            WaitforTaskSet( const ITaskSet* pTaskSet );
@@ -108,29 +550,178 @@ namespace enki
 		void            WaitforAllAndShutdown();
 
 		// Returns the number of threads created for running tasks + 1
-		// to account for the main thread.
+		// to account for the main thread, + TaskSchedulerConfig::numExternalThreads.
+		// threadnum passed to tasks is always less than this.
 		uint32_t        GetNumTaskThreads() const;
 
+		// Sets the number of threads which run tasks, including thread 0, from 1 to TaskSchedulerConfig::numThreads,
+		// for example to follow changes to a container's CPU quota. Surplus task threads are parked once their
+		// current task returns and sleep until re-activated. Their queued partitions are run by the active
+		// threads, and their pinned tasks still run. No threads are created or destroyed, and pipes are kept.
+		// Call from one thread at a time. Initialize activates all threads.
+		void            SetNumActiveThreads( uint32_t numActiveThreads_ );
+		uint32_t        GetNumActiveThreads() const;
+
+		// Returns the number of threads pinned to a CPU, see TaskSchedulerConfig::pinThreadsToCPUs.
+		// Less than the number of threads created if some of their CPUs could not be used.
+		uint32_t        GetNumPinnedThreads() const;
+
+		// Reserves an external thread slot for the calling thread, so that a thread not created
+		// by the scheduler can add tasks, and run them whilst waiting, without racing with
+		// thread 0 on its pipes. Returns false if all slots are in use, see
+		// TaskSchedulerConfig::numExternalThreads. Threads which are not registered use thread 0's slot.
+		// Thread 0, task threads and threads already registered must not register, and return false.
+		bool            RegisterExternalThread();
+
+		// Releases the calling thread's slot, which must have been reserved with RegisterExternalThread.
+		// Call before the thread exits, and before the scheduler is shut down or re-initialized.
+		void            DeregisterExternalThread();
+
+		// Calls func_( index ) for each index in [begin_, end_) in parallel, and waits for completion.
+		// minRange_ sets ITaskSet::m_MinRange. Same restrictions as WaitforTaskSet.
+		template<typename F>
+		void            ParallelFor( uint32_t begin_, uint32_t end_, const F& func_, uint32_t minRange_ = 1 );
+
 	private:
 		static THREADFUNC_DECL  TaskingThreadFunction( void* pArgs );
+		static void      FiberFunction( void* pArgs );
+		void             RunTasks( uint32_t threadNum );
+		void             WaitWhileParked( uint32_t threadNum );
+		bool             HaveParkedThreadWork( uint32_t threadNum ) const;
+		void             SetNumPartitions( uint32_t numActiveThreads );
+		bool             TryParkFiber( uint32_t threadNum, const ITaskSet* pTaskSet );
+		bool             TryResumeParkedFiber( uint32_t threadNum );
+		Fiber*           GetReadyParkedFiber( uint32_t threadNum ) const;
+		void             SwitchFiber( uint32_t threadNum, Fiber* pFiber );
 		bool             TryRunTask( uint32_t threadNum );
+		bool             TryRunDeadlineTask( uint32_t threadNum );
+		bool             TryAddNumaTaskSets( uint32_t threadNum );
+		void             AddTaskSetPartitions( ITaskSet* pTaskSet );
+		void             AllocateThreadMemory( uint32_t threadNum );
+		uint32_t         GetCurrentNumaNode() const;
+		void             AddDeadlineTaskSet( ITaskSet* pTaskSet );
+		void             PopDeadlineTaskSet();
+		void             SplitAndExecuteRange( ITaskSet* pTaskSet, TaskSetPartition range, uint32_t threadNum );
+		uint32_t         GetPartitionSize( const ITaskSet* pTaskSet ) const;
+		void             ExecuteRange( ITaskSet* pTaskSet, TaskSetPartition range, uint32_t threadNum );
+		void             ExecuteRangeTimed( ITaskSet* pTaskSet, TaskSetPartition range, uint32_t threadNum );
+		void*            AllocatePooledTaskSet( void (*pDestroy)( ITaskSet* ) );
+		void             FreePooledTaskSet( ITaskSet* pTaskSet );
+		template<typename T> static void DestroyPooledTaskSet( ITaskSet* pTaskSet )
+		{
+			static_cast<T*>( pTaskSet )->~T();
+		}
+		void             RunPinnedTasks( uint32_t threadNum );
+		bool             HaveTasks( uint32_t threadNum ) const;
+		void             PartitionComplete( ITaskSet* pTaskSet );
+		void             SetDependentsPending( ITaskSet* pTaskSet );
 		void             StartThreads();
 		void             StopThreads( bool bWait_ );
+		void             DeletePipes();
+		void             WaitForNewTasks( uint32_t threadNum );
+		void             WaitForTaskSetCompletion( const ITaskSet* pTaskSet, uint32_t threadNum );
+		void             SleepThread( uint32_t threadNum, bool bCancelSleep );
+		void             WakeThreadsWaitingForTaskSet( const ITaskSet* pTaskSet );
+		void             WaitForPinnedTaskCompletion( const IPinnedTask* pTask, uint32_t threadNum );
+		void             WakeThreadsWaitingForPinnedTask( const IPinnedTask* pTask );
+		void             WakeThreads( int32_t maxToWake_ );
+		bool             WakeThread( uint32_t threadNum );
+		void             UpdateCacheGroup( uint32_t threadNum );
+		void             ProcessTimedTasks();
+		void             InsertTimedTask( TimedTask* pTimedTask, uint64_t nowNS );
+		void             RunTimedTask( TimedTask* pTimedTask, uint64_t nowNS );
+		void             RemoveTimedTask( TimedTask* pTimedTask );
+		void             SetTimedTaskDeadline( uint64_t deadlineNS );
+		void             ClearTimedTasks();
 
-		TaskPipe*                                                m_pPipesPerThread;
+		TaskPipe**                                               m_pPipesPerThread; // [ thread ][ priority ]
+		PinnedTaskList*                                          m_pPinnedTaskListPerThread;
 
 		uint32_t                                                 m_NumThreads;
+		TaskSchedulerConfig                                      m_Config;
 		ThreadArgs*                                              m_pThreadNumStore;
+		ThreadDataStore*                                         m_pThreadDataStore;
 		threadid_t*                                              m_pThreadIDs;
 		volatile bool                                            m_bRunning;
 		volatile int32_t                                         m_NumThreadsRunning;
 		volatile int32_t                                         m_NumThreadsActive;
-		uint32_t                                                 m_NumPartitions;
-		eventid_t                                                m_NewTaskEvent;
+		volatile int32_t                                         m_NumThreadsSleeping;
+		volatile int32_t                                         m_NumThreadsWaitingForTaskSets;
+		volatile int32_t                                         m_NumThreadsWaitingForPinnedTasks;
+		volatile uint32_t                                        m_NumActiveThreads; // see SetNumActiveThreads
+		volatile int32_t                                         m_NumExternalThreadsRegistered;
+		const uint32_t*                                          m_pThread0ThreadNum; // see RegisterExternalThread
+		volatile uint32_t                                        m_NumPartitions;
+		uint64_t                                                 m_AutoPartitionTargetCycles;
+		TaskPoolSlot*                                            m_pTaskPool;
+		char*                                                    m_pTaskPoolMemory;
+		uint32_t*                                                m_pCacheGroupPerCPU;
+		uint32_t                                                 m_NumCPUs;
 		bool                                                     m_bHaveThreads;
 
+		// timer wheel for AddTimedTask, only accessed by the thread holding m_TimedTaskLock
+		TimedTaskList*                                           m_pTimedTaskInbox;
+		TimedTask**                                              m_pTimerWheel;
+		uint64_t                                                 m_TimerWheelTick;
+		volatile uint32_t                                        m_TimedTaskLock;
+		volatile int32_t                                         m_NumTimedTasks;
+		volatile int32_t                                         m_bTimedTaskStopRequested;
+		volatile uint64_t                                        m_TimedTaskNextDeadlineNS;
+		volatile uint32_t                                        m_TimerSleepThread;
+		volatile uint64_t                                        m_TimerSleepUntilNS;
+
+		// task sets with a deadline in a binary min heap, earliest first, see TryRunDeadlineTask
+		DeadlineTaskSet*                                         m_pDeadlineHeap;
+		uint32_t                                                 m_DeadlineHeapSize;
+		uint32_t                                                 m_DeadlineHeapCapacity;
+		uint64_t                                                 m_NumDeadlineTaskSetsAdded;
+		volatile uint32_t                                        m_DeadlineTaskSetsLock;
+		volatile int32_t                                         m_NumDeadlineTaskSets;
+
+		// fiber pools, see TaskSchedulerConfig::useFibers
+		Fiber*                                                   m_pFibers;
+		volatile int32_t                                         m_NumParkedFibers;
+
+		// see TaskSchedulerConfig::numaAware
+		uint32_t*                                                m_pNumaNodePerCPU;
+		uint32_t                                                 m_NumNumaNodes;
+		volatile int32_t*                                        m_pNumThreadsPerNumaNode;
+		TaskSetList*                                             m_pTaskSetInboxPerNumaNode;
+		volatile int32_t                                         m_NumNumaInboxTaskSets;
+		volatile int32_t                                         m_NumThreadsStarting;
+		uint32_t                                                 m_NumPinnedThreads;
+		volatile int64_t                                         m_NumDeadlineTaskSetsRun;
+		volatile int64_t                                         m_NumDeadlineMisses;
+
 		TaskScheduler( const TaskScheduler& nocopy );
 		TaskScheduler& operator=( const TaskScheduler& nocopy );
 	};
 
+	template<typename F> inline
+		void TaskScheduler::ParallelFor( uint32_t begin_, uint32_t end_, const F& func_, uint32_t minRange_ )
+	{
+		ParallelForTaskSet<F> task( begin_, end_, func_ );
+		task.m_MinRange = minRange_;
+		AddTaskSetToPipe( &task );
+		WaitforTaskSet( &task );
+	}
+
+	template<typename F> inline
+		bool TaskScheduler::AddTaskSetFireAndForget( uint32_t setSize_, const F& func_, TaskPriority priority_ )
+	{
+		// a compile error here means the task set is too large for the pool slot
+		typedef char PooledTaskSetTooLarge[ sizeof( TaskSet<F> ) <= POOLED_TASK_SET_MAX_SIZE ? 1 : -1 ];
+		(void)sizeof( PooledTaskSetTooLarge );
+
+		void* pMemory = AllocatePooledTaskSet( &DestroyPooledTaskSet< TaskSet<F> > );
+		if( !pMemory )
+		{
+			return false;
+		}
+		TaskSet<F>* pTaskSet = new( pMemory ) TaskSet<F>( setSize_, func_ );
+		pTaskSet->m_Priority = priority_;
+		AddTaskSetToPipe( pTaskSet );
+		return true;
+	}
+
 }
\ No newline at end of file
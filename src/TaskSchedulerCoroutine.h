@@ -0,0 +1,226 @@
+// Copyright (c) 2013 Doug Binks
+// 
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any damages
+// arising from the use of this software.
+// 
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+// 
+// 1. The origin of this software must not be misrepresented; you must not
+//    claim that you wrote the original software. If you use this software
+//    in a product, an acknowledgement in the product documentation would be
+//    appreciated but is not required.
+// 2. Altered source versions must be plainly marked as such, and must not be
+//    misrepresented as being the original software.
+// 3. This notice may not be removed or altered from any source distribution.
+
+#pragma once
+
+// C++20 coroutine support, requires a compiler with C++20 coroutines. Header only, the
+// library itself does not need C++20. Usage:
+//
+//   enki::Coroutine MultiStageJob( enki::TaskScheduler& ts_ )
+//   {
+//       co_await enki::AddTaskSetAndAwait( ts_, &stage1 );
+//       // continues on the thread which completed stage1
+//       co_await enki::AddTaskSetAndAwait( ts_, &stage2 );
+//   }
+//
+//   enki::Coroutine job = MultiStageJob( g_TS );
+//   enki::WaitforCoroutine( g_TS, job );
+
+#include <assert.h>
+#include <exception>
+#include <coroutine>
+
+#include "TaskScheduler.h"
+
+namespace enki
+{
+	// TaskSetAwaitable - adds a task set to the pipe and suspends the awaiting coroutine until it
+	// completes. The coroutine is resumed by the thread which completes the last partition, so no
+	// thread waits or runs other tasks on the coroutine's behalf with WaitforTaskSet.
+	// If the task set completes before the coroutine has suspended, it continues without suspending.
+	// The task set should not have dependencies, and must not be running already.
+	class TaskSetAwaitable
+	{
+	public:
+		TaskSetAwaitable( TaskScheduler& taskScheduler_, ITaskSet* pTaskSet_ )
+			: m_TaskScheduler( taskScheduler_ )
+			, m_pTaskSet( pTaskSet_ )
+			, m_State( STATE_ADDING )
+		{}
+
+		bool                    await_ready() const
+		{
+			return false;
+		}
+
+		bool                    await_suspend( std::coroutine_handle<> handle_ )
+		{
+			m_Handle = handle_;
+			m_State  = STATE_ADDING;
+			m_pTaskSet->SetCompletionFunction( &OnComplete, this );
+			m_TaskScheduler.AddTaskSetToPipe( m_pTaskSet );
+
+			// suspend unless the task set has already completed, in which case OnComplete
+			// did not resume us. Either way this must not be used after the CAS.
+			return STATE_ADDING == AtomicCompareAndSwap( &m_State, STATE_SUSPENDED, STATE_ADDING );
+		}
+
+		void                    await_resume() const {}
+
+		TaskScheduler&          GetTaskScheduler() const
+		{
+			return m_TaskScheduler;
+		}
+
+	private:
+		enum State
+		{
+			STATE_ADDING,
+			STATE_SUSPENDED,
+			STATE_COMPLETE,
+		};
+
+		static void             OnComplete( void* pArg_ )
+		{
+			TaskSetAwaitable* pThis = static_cast<TaskSetAwaitable*>( pArg_ );
+			if( STATE_ADDING != AtomicCompareAndSwap( &pThis->m_State, STATE_COMPLETE, STATE_ADDING ) )
+			{
+				// await_suspend has returned, so we own the resumption
+				pThis->m_Handle.resume();
+			}
+		}
+
+		TaskScheduler&          m_TaskScheduler;
+		ITaskSet*               m_pTaskSet;
+		std::coroutine_handle<> m_Handle;
+		volatile uint32_t       m_State;
+	};
+
+	inline TaskSetAwaitable AddTaskSetAndAwait( TaskScheduler& taskScheduler_, ITaskSet* pTaskSet_ )
+	{
+		return TaskSetAwaitable( taskScheduler_, pTaskSet_ );
+	}
+
+	// Coroutine - return type for coroutines which co_await task sets. Starts running on the calling
+	// thread, and after each co_await continues on the thread which completed the task set.
+	// Must not be destroyed until GetIsComplete(), see WaitforCoroutine. Exceptions terminate.
+	class Coroutine
+	{
+	public:
+		struct promise_type
+		{
+			// Completes when the coroutine does, so that waiting threads sleep and are woken as for
+			// any task set. It is incomplete from creation, and added once the frame has suspended.
+			class CompletionTaskSet : public ITaskSet
+			{
+			public:
+				virtual void    ExecuteRange( TaskSetPartition, uint32_t ) {}
+			};
+
+			// user declared so the promise is not an aggregate, which C++20 would
+			// initialize from the coroutine's parameters
+			promise_type() : m_pTaskScheduler(NULL)
+			{
+				m_Completion.m_CompletionCount = 1;
+			}
+
+			struct FinalAwaitable
+			{
+				bool            await_ready() const noexcept { return false; }
+				void            await_suspend( std::coroutine_handle<promise_type> handle_ ) noexcept
+				{
+					// the frame is suspended, so can be destroyed once the completion task set is
+					// complete, and must not be used after adding it
+					promise_type& promise = handle_.promise();
+					if( promise.m_pTaskScheduler )
+					{
+						promise.m_pTaskScheduler->AddTaskSetToPipe( &promise.m_Completion );
+					}
+					else
+					{
+						// never suspended, so completed before get_return_object's caller could wait
+						AtomicStore( &promise.m_Completion.m_CompletionCount, 0, MEMORY_ORDER_RELEASE );
+					}
+				}
+				void            await_resume() const noexcept {}
+			};
+
+			Coroutine           get_return_object()       { return Coroutine( std::coroutine_handle<promise_type>::from_promise( *this ) ); }
+			std::suspend_never  initial_suspend() noexcept { return std::suspend_never(); }
+			FinalAwaitable      final_suspend() noexcept   { return FinalAwaitable(); }
+			void                return_void()             {}
+			void                unhandled_exception()     { std::terminate(); }
+
+			// records the scheduler which adds the completion task set
+			TaskSetAwaitable&&  await_transform( TaskSetAwaitable&& awaitable_ )
+			{
+				SetTaskScheduler( awaitable_.GetTaskScheduler() );
+				return static_cast<TaskSetAwaitable&&>( awaitable_ );
+			}
+			TaskSetAwaitable&   await_transform( TaskSetAwaitable& awaitable_ )
+			{
+				SetTaskScheduler( awaitable_.GetTaskScheduler() );
+				return awaitable_;
+			}
+			template<typename A>
+			A&&                 await_transform( A&& awaitable_ )
+			{
+				return static_cast<A&&>( awaitable_ );
+			}
+
+			void                SetTaskScheduler( TaskScheduler& taskScheduler_ )
+			{
+				assert( !m_pTaskScheduler || m_pTaskScheduler == &taskScheduler_ );
+				m_pTaskScheduler = &taskScheduler_;
+			}
+
+			CompletionTaskSet   m_Completion;
+			TaskScheduler*      m_pTaskScheduler;
+		};
+
+		Coroutine( Coroutine&& other_ )
+			: m_Handle( other_.m_Handle )
+		{
+			other_.m_Handle = NULL;
+		}
+
+		~Coroutine()
+		{
+			if( m_Handle )
+			{
+				assert( GetIsComplete() );
+				m_Handle.destroy();
+			}
+		}
+
+		bool                    GetIsComplete() const
+		{
+			return m_Handle.promise().m_Completion.GetIsComplete();
+		}
+
+		// Task set which completes with the coroutine, see WaitforCoroutine
+		const ITaskSet*         GetCompletionTaskSet() const
+		{
+			return &m_Handle.promise().m_Completion;
+		}
+
+	private:
+		explicit Coroutine( std::coroutine_handle<promise_type> handle_ ) : m_Handle( handle_ ) {}
+		Coroutine( const Coroutine& nocopy );
+		Coroutine& operator=( const Coroutine& nocopy );
+
+		std::coroutine_handle<promise_type> m_Handle;
+	};
+
+	// Runs tasks until the coroutine completes, sleeping when there are none, with the same
+	// restrictions as TaskScheduler::WaitforTaskSet
+	inline void WaitforCoroutine( TaskScheduler& taskScheduler_, const Coroutine& coroutine_ )
+	{
+		taskScheduler_.WaitforTaskSet( coroutine_.GetCompletionTaskSet() );
+	}
+}
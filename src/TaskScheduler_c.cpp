@@ -25,6 +25,10 @@ struct enkiTaskScheduler : TaskScheduler
 {
 };
 
+struct enkiDependency : Dependency
+{
+};
+
 struct enkiTaskSet : ITaskSet
 {
 	enkiTaskSet( enkiTaskExecuteRange taskFun_ ) : taskFun(taskFun_), pArgs(NULL) {}
@@ -38,6 +42,36 @@ struct enkiTaskSet : ITaskSet
 	void* pArgs;
 };
 
+// functor for TaskScheduler::AddTaskSetFireAndForget
+struct enkiTaskExecuteRangeFunctor
+{
+	void            operator()( TaskSetPartition range, uint32_t threadnum ) const
+	{
+		taskFun( range.start, range.end, threadnum, pArgs );
+	}
+
+	enkiTaskExecuteRange taskFun;
+	void* pArgs;
+};
+
+struct enkiTimedTask : TimedTask
+{
+	enkiTimedTask( enkiTaskSet* pTaskSet_ ) : TimedTask( pTaskSet_ ) {}
+};
+
+struct enkiPinnedTask : IPinnedTask
+{
+	enkiPinnedTask( enkiPinnedTaskExecute taskFun_, uint32_t threadNum_ ) : IPinnedTask( threadNum_ ), taskFun(taskFun_), pArgs(NULL) {}
+
+	void            Execute() override
+	{
+		taskFun( pArgs );
+	}
+
+	enkiPinnedTaskExecute taskFun;
+	void* pArgs;
+};
+
 enkiTaskScheduler*	enkiCreateTaskScheduler()
 {
 	enkiTaskScheduler* pETS = new enkiTaskScheduler();
@@ -52,11 +86,83 @@ enkiTaskScheduler*	enkiCreateTaskSchedulerNumThreads( uint32_t numThreads_ )
 	return pETS;
 }
 
+enkiTaskSchedulerConfig enkiGetTaskSchedulerConfigDefaults()
+{
+	TaskSchedulerConfig config;
+	enkiTaskSchedulerConfig configC;
+	configC.numThreads   = config.numThreads;
+	configC.numExternalThreads = config.numExternalThreads;
+	configC.pipeCapacity = config.pipeCapacity;
+	configC.pooledTaskSetsPerThread = config.pooledTaskSetsPerThread;
+	configC.stealFromSharedCacheFirst = config.stealFromSharedCacheFirst ? 1 : 0;
+	configC.numaAware        = config.numaAware ? 1 : 0;
+	configC.pinThreadsToCPUs = config.pinThreadsToCPUs ? 1 : 0;
+	configC.pThreadCPUs      = config.pThreadCPUs;
+	configC.numThreadCPUs    = config.numThreadCPUs;
+	configC.partitionMode = (enkiTaskPartitionMode)config.partitionMode;
+	configC.autoPartitionTargetNS = config.autoPartitionTargetNS;
+	configC.useFibers       = config.useFibers ? 1 : 0;
+	configC.fibersPerThread = config.fibersPerThread;
+	configC.fiberStackSize  = config.fiberStackSize;
+	return configC;
+}
+
+enkiTaskScheduler*	enkiCreateTaskSchedulerWithConfig( enkiTaskSchedulerConfig config_ )
+{
+	TaskSchedulerConfig config;
+	config.numThreads   = config_.numThreads;
+	config.numExternalThreads = config_.numExternalThreads;
+	config.pipeCapacity = config_.pipeCapacity;
+	config.pooledTaskSetsPerThread = config_.pooledTaskSetsPerThread;
+	config.stealFromSharedCacheFirst = 0 != config_.stealFromSharedCacheFirst;
+	config.numaAware        = 0 != config_.numaAware;
+	config.pinThreadsToCPUs = 0 != config_.pinThreadsToCPUs;
+	config.pThreadCPUs      = config_.pThreadCPUs;
+	config.numThreadCPUs    = config_.numThreadCPUs;
+	config.partitionMode = (TaskPartitionMode)config_.partitionMode;
+	config.autoPartitionTargetNS = config_.autoPartitionTargetNS;
+	config.useFibers       = 0 != config_.useFibers;
+	config.fibersPerThread = config_.fibersPerThread;
+	config.fiberStackSize  = config_.fiberStackSize;
+
+	enkiTaskScheduler* pETS = new enkiTaskScheduler();
+	pETS->Initialize( config );
+	return pETS;
+}
+
 void				enkiDeleteTaskScheduler( enkiTaskScheduler* pETS_ )
 {
 	delete pETS_;
 }
 
+enkiCPUResources	enkiGetCPUResources()
+{
+	CPUResources resources = GetCPUResources();
+	enkiCPUResources resourcesC;
+	resourcesC.numOnlineCPUs   = resources.numOnlineCPUs;
+	resourcesC.numAffinityCPUs = resources.numAffinityCPUs;
+	resourcesC.cpuQuotaMilli   = resources.cpuQuotaMilli;
+	resourcesC.numUsableCPUs   = resources.numUsableCPUs;
+	return resourcesC;
+}
+
+enkiTaskSchedulerStats enkiGetTaskSchedulerStats( enkiTaskScheduler* pETS_ )
+{
+	TaskSchedulerStats stats = pETS_->GetStats();
+	enkiTaskSchedulerStats statsC;
+	statsC.numPartitionsRun = stats.numPartitionsRun;
+	statsC.numStealAttempts = stats.numStealAttempts;
+	statsC.numSteals        = stats.numSteals;
+	statsC.numDeadlineTaskSetsRun = stats.numDeadlineTaskSetsRun;
+	statsC.numDeadlineMisses      = stats.numDeadlineMisses;
+	return statsC;
+}
+
+void				enkiResetTaskSchedulerStats( enkiTaskScheduler* pETS_ )
+{
+	pETS_->ResetStats();
+}
+
 enkiTaskSet*		enkiCreateTaskSet( enkiTaskScheduler* pETS_, enkiTaskExecuteRange taskFunc_  )
 {
 	return new enkiTaskSet( taskFunc_ );
@@ -72,6 +178,81 @@ void				enkiAddTaskSetToPipe( enkiTaskScheduler* pETS_, enkiTaskSet* pTaskSet_,
 	pETS_->AddTaskSetToPipe( pTaskSet_ );
 }
 
+int					enkiAddTaskSetFireAndForget( enkiTaskScheduler* pETS_, enkiTaskExecuteRange taskFunc_, void* pArgs_, uint32_t setSize_ )
+{
+	assert( taskFunc_ );
+	enkiTaskExecuteRangeFunctor functor;
+	functor.taskFun = taskFunc_;
+	functor.pArgs   = pArgs_;
+	return pETS_->AddTaskSetFireAndForget( setSize_, functor ) ? 1 : 0;
+}
+
+void				enkiSetTaskSetArgs( enkiTaskSet* pTaskSet_, void* pArgs_, uint32_t setSize_ )
+{
+	assert( pTaskSet_ );
+	pTaskSet_->m_SetSize = setSize_;
+	pTaskSet_->pArgs = pArgs_;
+}
+
+void				enkiSetTaskSetPartitionHints( enkiTaskSet* pTaskSet_, uint32_t minRange_, uint32_t maxPartitions_ )
+{
+	assert( pTaskSet_ );
+	pTaskSet_->m_MinRange      = minRange_;
+	pTaskSet_->m_MaxPartitions = maxPartitions_;
+}
+
+void				enkiSetTaskSetPriority( enkiTaskSet* pTaskSet_, enkiTaskPriority priority_ )
+{
+	assert( pTaskSet_ );
+	assert( priority_ < ENKI_TASK_PRIORITY_NUM );
+	pTaskSet_->m_Priority = (TaskPriority)priority_;
+}
+
+void				enkiSetTaskSetDeadline( enkiTaskSet* pTaskSet_, uint64_t deadlineNS_ )
+{
+	assert( pTaskSet_ );
+	pTaskSet_->m_DeadlineNS = deadlineNS_;
+}
+
+void				enkiSetTaskSetPreferredNumaNode( enkiTaskSet* pTaskSet_, uint32_t numaNode_ )
+{
+	assert( pTaskSet_ );
+	pTaskSet_->m_PreferredNumaNode = numaNode_;
+}
+
+uint64_t			enkiGetTimeNS()
+{
+	return GetTimeNS();
+}
+
+enkiDependency*		enkiCreateDependency( enkiTaskScheduler* pETS_ )
+{
+	return new enkiDependency();
+}
+
+void				enkiDeleteDependency( enkiTaskScheduler* pETS_, enkiDependency* pDependency_ )
+{
+	delete pDependency_;
+}
+
+void				enkiSetDependency( enkiDependency* pDependency_, enkiTaskSet* pDependencyTask_, enkiTaskSet* pTaskToRunOnCompletion_ )
+{
+	assert( pDependency_ );
+	pTaskToRunOnCompletion_->SetDependency( *pDependency_, pDependencyTask_ );
+}
+
+void				enkiCancelTaskSet( enkiTaskSet* pTaskSet_ )
+{
+	assert( pTaskSet_ );
+	pTaskSet_->Cancel();
+}
+
+int					enkiIsTaskSetCancelled( enkiTaskSet* pTaskSet_ )
+{
+	assert( pTaskSet_ );
+	return ( pTaskSet_->GetIsCancelled() ) ? 1 : 0;
+}
+
 int				enkiIsTaskSetComplete( enkiTaskScheduler* pETS_, enkiTaskSet* pTaskSet_ )
 {
 	assert( pTaskSet_ );
@@ -89,7 +270,92 @@ void				enkiWaitForAll( enkiTaskScheduler* pETS_ )
 }
 
 
+enkiPinnedTask*		enkiCreatePinnedTask( enkiTaskScheduler* pETS_, enkiPinnedTaskExecute taskFunc_, uint32_t threadNum_ )
+{
+	return new enkiPinnedTask( taskFunc_, threadNum_ );
+}
+
+int					enkiAddPinnedTask( enkiTaskScheduler* pETS_, enkiPinnedTask* pTask_, void* pArgs_ )
+{
+	assert( pTask_ );
+	assert( pTask_->taskFun );
+
+	pTask_->pArgs = pArgs_;
+	return pETS_->AddPinnedTask( pTask_ ) ? 1 : 0;
+}
+
+void				enkiRunPinnedTasks( enkiTaskScheduler* pETS_ )
+{
+	pETS_->RunPinnedTasks();
+}
+
+int					enkiIsPinnedTaskComplete( enkiTaskScheduler* pETS_, enkiPinnedTask* pTask_ )
+{
+	assert( pTask_ );
+	return ( pTask_->GetIsComplete() ) ? 1 : 0;
+}
+
+void				enkiWaitForPinnedTask( enkiTaskScheduler* pETS_, enkiPinnedTask* pTask_ )
+{
+	pETS_->WaitforPinnedTask( pTask_ );
+}
+
+enkiTimedTask*		enkiCreateTimedTask( enkiTaskScheduler* pETS_, enkiTaskSet* pTaskSet_ )
+{
+	assert( pTaskSet_ );
+	return new enkiTimedTask( pTaskSet_ );
+}
+
+void				enkiDeleteTimedTask( enkiTaskScheduler* pETS_, enkiTimedTask* pTimedTask_ )
+{
+	assert( !pTimedTask_ || !pTimedTask_->GetIsActive() );
+	delete pTimedTask_;
+}
+
+void				enkiAddTimedTask( enkiTaskScheduler* pETS_, enkiTimedTask* pTimedTask_, uint64_t delayNS_, uint64_t periodNS_ )
+{
+	assert( pTimedTask_ );
+	pETS_->AddTimedTask( pTimedTask_, delayNS_, periodNS_ );
+}
+
+void				enkiStopTimedTask( enkiTaskScheduler* pETS_, enkiTimedTask* pTimedTask_ )
+{
+	assert( pTimedTask_ );
+	pETS_->StopTimedTask( pTimedTask_ );
+}
+
+int					enkiIsTimedTaskActive( enkiTaskScheduler* pETS_, enkiTimedTask* pTimedTask_ )
+{
+	assert( pTimedTask_ );
+	return ( pTimedTask_->GetIsActive() ) ? 1 : 0;
+}
+
 uint32_t			enkiGetNumTaskThreads( enkiTaskScheduler* pETS_ )
 {
 	return pETS_->GetNumTaskThreads();
 }
+
+void				enkiSetNumActiveThreads( enkiTaskScheduler* pETS_, uint32_t numActiveThreads_ )
+{
+	pETS_->SetNumActiveThreads( numActiveThreads_ );
+}
+
+uint32_t			enkiGetNumActiveThreads( enkiTaskScheduler* pETS_ )
+{
+	return pETS_->GetNumActiveThreads();
+}
+
+uint32_t			enkiGetNumPinnedThreads( enkiTaskScheduler* pETS_ )
+{
+	return pETS_->GetNumPinnedThreads();
+}
+
+int					enkiRegisterExternalThread( enkiTaskScheduler* pETS_ )
+{
+	return pETS_->RegisterExternalThread() ? 1 : 0;
+}
+
+void				enkiDeregisterExternalThread( enkiTaskScheduler* pETS_ )
+{
+	pETS_->DeregisterExternalThread();
+}
@@ -26,12 +26,75 @@ extern "C" {
 
 typedef struct enkiTaskScheduler enkiTaskScheduler;
 typedef struct enkiTaskSet		 enkiTaskSet;
+typedef struct enkiDependency	 enkiDependency;
+typedef struct enkiPinnedTask	 enkiPinnedTask;
+typedef struct enkiTimedTask	 enkiTimedTask;
 
 typedef void (* enkiTaskExecuteRange)( uint32_t start_, uint32_t end, uint32_t threadnum_, void* pArgs_ );
-
-
-// Create a task scheduler - will create GetNumHardwareThreads()-1 threads, which is
-// sufficient to fill the system when including the main thread.
+typedef void (* enkiPinnedTaskExecute)( void* pArgs_ );
+
+// Task priorities, see enki::TaskPriority in TaskScheduler.h
+typedef enum enkiTaskPriority
+{
+	ENKI_TASK_PRIORITY_HIGH,
+	ENKI_TASK_PRIORITY_MED,
+	ENKI_TASK_PRIORITY_LOW,
+	ENKI_TASK_PRIORITY_NUM
+} enkiTaskPriority;
+
+// Task set partitioning modes, see enki::TaskPartitionMode in TaskScheduler.h
+typedef enum enkiTaskPartitionMode
+{
+	ENKI_TASK_PARTITION_MODE_EAGER,
+	ENKI_TASK_PARTITION_MODE_LAZY_SPLIT
+} enkiTaskPartitionMode;
+
+// Scheduler configuration, see enki::TaskSchedulerConfig in TaskScheduler.h
+// Get defaults with enkiGetTaskSchedulerConfigDefaults()
+typedef struct enkiTaskSchedulerConfig
+{
+	uint32_t numThreads;   // including thread which creates the scheduler, 0 for enkiGetCPUResources().numUsableCPUs
+	uint32_t numExternalThreads; // slots for threads registered with enkiRegisterExternalThread
+	uint32_t pipeCapacity; // task partitions per thread pipe before it needs to grow, 0 for default
+	uint32_t pooledTaskSetsPerThread; // fire and forget task sets in flight per thread, 0 for default
+	int      stealFromSharedCacheFirst; // non zero to steal from threads sharing the last level cache first
+	int      numaAware;        // non zero for NUMA node local pipes, stealing and preferred nodes
+	int      pinThreadsToCPUs; // non zero to pin each created thread to a CPU
+	const uint32_t* pThreadCPUs; // CPUs to pin threads to, NULL for one per physical core first
+	uint32_t numThreadCPUs;      // number of CPUs in pThreadCPUs
+	enkiTaskPartitionMode partitionMode; // how task sets are divided into partitions
+	uint32_t autoPartitionTargetNS; // non zero to size partitions to take this long using measured cost
+	int      useFibers;       // non zero to park tasks which wait on a fiber, and run other tasks on another
+	uint32_t fibersPerThread; // fibers in each task thread's pool, 0 for default
+	uint32_t fiberStackSize;  // stack size of each fiber in bytes, 0 for default
+} enkiTaskSchedulerConfig;
+
+// Scheduler stats, see enki::TaskSchedulerStats in TaskScheduler.h
+typedef struct enkiTaskSchedulerStats
+{
+	uint64_t numPartitionsRun;
+	uint64_t numStealAttempts;
+	uint64_t numSteals;
+	uint64_t numDeadlineTaskSetsRun;
+	uint64_t numDeadlineMisses;
+} enkiTaskSchedulerStats;
+
+// CPUs the process can use, see enki::CPUResources in Threads.h
+typedef struct enkiCPUResources
+{
+	uint32_t numOnlineCPUs;   // CPUs in the system
+	uint32_t numAffinityCPUs; // CPUs in the process affinity mask
+	uint32_t cpuQuotaMilli;   // cgroup CPU quota in thousandths of a CPU, 0 if none
+	uint32_t numUsableCPUs;   // lower of numAffinityCPUs and cpuQuotaMilli rounded up, at least 1
+} enkiCPUResources;
+
+// Read the CPUs the process can use from the affinity mask and cgroup CPU quota.
+// Slow, so cache the result.
+enkiCPUResources	enkiGetCPUResources();
+
+
+// Create a task scheduler - will create enkiGetCPUResources().numUsableCPUs-1 threads, which is
+// sufficient to fill the CPUs available to the process when including the main thread.
 // Initialize can be called multiple times - it will wait for completion
 // before re-initializing.
 enkiTaskScheduler*	enkiCreateTaskScheduler();
@@ -41,16 +104,73 @@ enkiTaskScheduler*	enkiCreateTaskScheduler();
 // the thread on which the initialize was called.
 enkiTaskScheduler*	enkiCreateTaskSchedulerNumThreads( uint32_t numThreads_ );
 
+// Get a config with default values
+enkiTaskSchedulerConfig enkiGetTaskSchedulerConfigDefaults();
+
+// Create a task scheduler with the given config
+enkiTaskScheduler*	enkiCreateTaskSchedulerWithConfig( enkiTaskSchedulerConfig config_ );
+
 
 // Delete a task scheduler
 void				enkiDeleteTaskScheduler( enkiTaskScheduler* pETS_ );
 
+// Get stats summed over all threads, approximate whilst tasks are running
+enkiTaskSchedulerStats enkiGetTaskSchedulerStats( enkiTaskScheduler* pETS_ );
+
+// Reset stats to zero
+void				enkiResetTaskSchedulerStats( enkiTaskScheduler* pETS_ );
+
 // Create a task set.
 enkiTaskSet*		enkiCreateTaskSet( enkiTaskScheduler* pETS_, enkiTaskExecuteRange taskFunc_  );
 
 // schedule the task
 void				enkiAddTaskSetToPipe( enkiTaskScheduler* pETS_, enkiTaskSet* pTaskSet_, void* pArgs_, uint32_t setSize_ );
 
+// schedule a task which the scheduler owns and recycles once complete, so no enkiTaskSet is needed.
+// Returns 1 if added, or 0 if the calling thread has too many in flight, see enkiTaskSchedulerConfig
+int					enkiAddTaskSetFireAndForget( enkiTaskScheduler* pETS_, enkiTaskExecuteRange taskFunc_, void* pArgs_, uint32_t setSize_ );
+
+// Set the args and set size used when the task is launched by its dependencies completing.
+void				enkiSetTaskSetArgs( enkiTaskSet* pTaskSet_, void* pArgs_, uint32_t setSize_ );
+
+// Set the minimum range passed to the task function (defaults to 1), and the
+// maximum number of partitions the set is divided into (defaults to 0, no limit).
+void				enkiSetTaskSetPartitionHints( enkiTaskSet* pTaskSet_, uint32_t minRange_, uint32_t maxPartitions_ );
+
+// Set the priority of the task set, defaults to ENKI_TASK_PRIORITY_MED
+void				enkiSetTaskSetPriority( enkiTaskSet* pTaskSet_, enkiTaskPriority priority_ );
+
+// Set the time the task set should be complete by, in enkiGetTimeNS() time, or 0 for none (the default).
+// Task sets with a deadline run before those without, earliest deadline first.
+void				enkiSetTaskSetDeadline( enkiTaskSet* pTaskSet_, uint64_t deadlineNS_ );
+
+// For enkiSetTaskSetPreferredNumaNode when any node can run the task set
+#define ENKI_NUMA_NODE_ANY 0xFFFFFFFF
+
+// Set the NUMA node whose threads should run the task set, defaults to ENKI_NUMA_NODE_ANY.
+// Only used if the scheduler was created with numaAware set, see enki::ITaskSet::m_PreferredNumaNode
+void				enkiSetTaskSetPreferredNumaNode( enkiTaskSet* pTaskSet_, uint32_t numaNode_ );
+
+// Monotonic time in nanoseconds, used for deadlines
+uint64_t			enkiGetTimeNS();
+
+// Create a dependency, see enki::Dependency in TaskScheduler.h
+enkiDependency*		enkiCreateDependency( enkiTaskScheduler* pETS_ );
+
+// Delete a dependency, clearing it if set.
+void				enkiDeleteDependency( enkiTaskScheduler* pETS_, enkiDependency* pDependency_ );
+
+// Set pTaskToRunOnCompletion_ to be added to the pipe when pDependencyTask_ and any other dependencies complete.
+// Not thread safe - only change dependencies when none of the tasks involved are running.
+void				enkiSetDependency( enkiDependency* pDependency_, enkiTaskSet* pDependencyTask_, enkiTaskSet* pTaskToRunOnCompletion_ );
+
+// Cancel a task set which has been added, so partitions which have not started are skipped.
+// The task set still completes. Cleared when the task set is next added, see ITaskSet::Cancel.
+void				enkiCancelTaskSet( enkiTaskSet* pTaskSet_ );
+
+// Check if TaskSet has been cancelled, for polling in long running task functions. Returns 1 if cancelled, 0 if not.
+int					enkiIsTaskSetCancelled( enkiTaskSet* pTaskSet_ );
+
 // Check if TaskSet is complete. Doesn't wait. Returns 1 if complete, 0 if not.
 int					enkiIsTaskSetComplete( enkiTaskScheduler* pETS_, enkiTaskSet* pTaskSet_ );
 
@@ -66,9 +186,63 @@ void				enkiWaitForTaskSet( enkiTaskScheduler* pETS_, enkiTaskSet* pTaskSet_ );
 void				enkiWaitForAll( enkiTaskScheduler* pETS_ );
 
 
-// get number of threads
+// Create a pinned task, which runs on thread threadNum_ ( < enkiGetNumTaskThreads ).
+// Thread 0 is the thread which created the scheduler.
+enkiPinnedTask*		enkiCreatePinnedTask( enkiTaskScheduler* pETS_, enkiPinnedTaskExecute taskFunc_, uint32_t threadNum_ );
+
+// schedule a pinned task, returns 0 if threadNum_ is an external thread slot which is not registered
+int					enkiAddPinnedTask( enkiTaskScheduler* pETS_, enkiPinnedTask* pTask_, void* pArgs_ );
+
+// Run pinned tasks for the calling thread.
+// Thread 0 only runs pinned tasks when it calls this or one of the wait functions.
+void				enkiRunPinnedTasks( enkiTaskScheduler* pETS_ );
+
+// Check if pinned task is complete. Doesn't wait. Returns 1 if complete, 0 if not.
+int					enkiIsPinnedTaskComplete( enkiTaskScheduler* pETS_, enkiPinnedTask* pTask_ );
+
+// Wait for a given pinned task, same restrictions as enkiWaitForTaskSet.
+void				enkiWaitForPinnedTask( enkiTaskScheduler* pETS_, enkiPinnedTask* pTask_ );
+
+
+// Create a timed task which adds pTaskSet_ to the pipe, see enki::TimedTask in TaskScheduler.h
+// Set the task set's args and size with enkiSetTaskSetArgs.
+enkiTimedTask*		enkiCreateTimedTask( enkiTaskScheduler* pETS_, enkiTaskSet* pTaskSet_ );
+
+// Delete a timed task, which must not be active.
+void				enkiDeleteTimedTask( enkiTaskScheduler* pETS_, enkiTimedTask* pTimedTask_ );
+
+// Add the timed task's task set to the pipe after delayNS_, and every periodNS_ after that if non zero.
+// Can be called from any thread.
+void				enkiAddTimedTask( enkiTaskScheduler* pETS_, enkiTimedTask* pTimedTask_, uint64_t delayNS_, uint64_t periodNS_ );
+
+// Stop a timed task, it is removed asynchronously so wait for enkiIsTimedTaskActive to return 0.
+void				enkiStopTimedTask( enkiTaskScheduler* pETS_, enkiTimedTask* pTimedTask_ );
+
+// Returns 1 if the timed task is waiting to add its task set, 0 if not.
+int					enkiIsTimedTaskActive( enkiTaskScheduler* pETS_, enkiTimedTask* pTimedTask_ );
+
+
+// get number of threads, including external thread slots
 uint32_t			enkiGetNumTaskThreads( enkiTaskScheduler* pETS_ );
 
+// Set the number of threads which run tasks, from 1 to enkiTaskSchedulerConfig::numThreads.
+// Surplus threads are parked until re-activated, their queued work is run by the active threads.
+void				enkiSetNumActiveThreads( enkiTaskScheduler* pETS_, uint32_t numActiveThreads_ );
+
+// get number of threads currently running tasks
+uint32_t			enkiGetNumActiveThreads( enkiTaskScheduler* pETS_ );
+
+// get number of threads pinned to a CPU, less than the threads created if some CPUs could not be used
+uint32_t			enkiGetNumPinnedThreads( enkiTaskScheduler* pETS_ );
+
+// Reserve an external thread slot for the calling thread so it can add and run tasks.
+// Returns 1 if registered, or 0 if all slots are in use, see enkiTaskSchedulerConfig.
+// The thread which created the scheduler and task threads must not register.
+int					enkiRegisterExternalThread( enkiTaskScheduler* pETS_ );
+
+// Release the calling thread's external thread slot
+void				enkiDeregisterExternalThread( enkiTaskScheduler* pETS_ );
+
 
 
 #ifdef __cplusplus
@@ -21,9 +21,21 @@
 #include <stdint.h>
 #include <assert.h>
 
-#ifdef _WIN32
+#include "Atomics.h"
+
+namespace enki
+{
+    // CPUs the process can use, see GetCPUResources()
+    struct CPUResources
+    {
+        uint32_t numOnlineCPUs;   // CPUs in the system, as GetNumHardwareThreads()
+        uint32_t numAffinityCPUs; // CPUs in the process affinity mask
+        uint32_t cpuQuotaMilli;   // CPU time limit in thousandths of a CPU, such as a cgroup cpu.max quota, 0 if none
+        uint32_t numUsableCPUs;   // lower of numAffinityCPUs and cpuQuotaMilli rounded up, at least 1
+    };
+}
 
-	#include "Atomics.h"
+#ifdef _WIN32
 
 	#define WIN32_LEAN_AND_MEAN
 	#include <Windows.h>
@@ -34,21 +46,32 @@
 namespace enki
 {
     typedef HANDLE threadid_t;
-    struct eventid_t
-    {
-        HANDLE      event;
-        int32_t     countWaiters;
-    };
-    const uint32_t EVENTWAIT_INFINITE = INFINITE;
 
     // declare the thread start function as:
     // THREADFUNC_DECL MyThreadStart( void* pArg );
-    inline bool ThreadCreate( threadid_t* returnid, DWORD ( WINAPI *StartFunc) (void* ), void* pArg )
+    // cpu >= 0 pins the thread to that cpu before it starts, if possible.
+    // pbPinned, if not NULL, is set to whether the thread was pinned.
+    inline bool ThreadCreate( threadid_t* returnid, DWORD ( WINAPI *StartFunc) (void* ), void* pArg, int32_t cpu = -1, bool* pbPinned = NULL )
     {
         // posix equiv pthread_create
         DWORD threadid;
-        *returnid = CreateThread( 0, 0, StartFunc, pArg, 0, &threadid );
-        return  *returnid != NULL;
+        bool bPinned = false;
+        *returnid = CreateThread( 0, 0, StartFunc, pArg, CREATE_SUSPENDED, &threadid );
+        if( *returnid == NULL )
+        {
+            return false;
+        }
+        if( cpu >= 0 && cpu < (int32_t)( sizeof( DWORD_PTR ) * 8 ) )
+        {
+            // fails if the cpu is not in the process affinity mask
+            bPinned = 0 != SetThreadAffinityMask( *returnid, (DWORD_PTR)1 << cpu );
+        }
+        if( pbPinned )
+        {
+            *pbPinned = bPinned;
+        }
+        ResumeThread( *returnid );
+        return true;
     }
 
     inline bool ThreadTerminate( threadid_t threadid )
@@ -64,36 +87,181 @@ namespace enki
         return sysInfo.dwNumberOfProcessors;
     }
 
-    inline eventid_t EventCreate()
+    // Returns the CPUs the process can use. Job object CPU rate limits are not read.
+    inline CPUResources GetCPUResources()
+    {
+        CPUResources resources;
+        resources.numOnlineCPUs   = GetNumHardwareThreads();
+        resources.numAffinityCPUs = resources.numOnlineCPUs;
+        resources.cpuQuotaMilli   = 0;
+        DWORD_PTR processMask = 0;
+        DWORD_PTR systemMask  = 0;
+        if( GetProcessAffinityMask( GetCurrentProcess(), &processMask, &systemMask ) && processMask )
+        {
+            uint32_t numCPUs = 0;
+            for( ; processMask; processMask &= processMask - 1 )
+            {
+                ++numCPUs;
+            }
+            resources.numAffinityCPUs = numCPUs;
+        }
+        resources.numUsableCPUs = resources.numAffinityCPUs ? resources.numAffinityCPUs : 1;
+        return resources;
+    }
+
+    // Writes up to maxCPUs of the CPUs in the process affinity mask to pCPUs in ascending order,
+    // and returns how many there are. Pass pCPUs NULL to count them.
+    inline uint32_t GetAffinityCPUs( uint32_t* pCPUs, uint32_t maxCPUs )
+    {
+        DWORD_PTR processMask = 0;
+        DWORD_PTR systemMask  = 0;
+        if( !GetProcessAffinityMask( GetCurrentProcess(), &processMask, &systemMask ) || !processMask )
+        {
+            processMask = ~(DWORD_PTR)0;
+            uint32_t numCPUs = GetNumHardwareThreads();
+            if( numCPUs < sizeof( DWORD_PTR ) * 8 )
+            {
+                processMask = ( (DWORD_PTR)1 << numCPUs ) - 1;
+            }
+        }
+        uint32_t numCPUs = 0;
+        for( uint32_t cpu = 0; cpu < sizeof( DWORD_PTR ) * 8; ++cpu )
+        {
+            if( processMask & ( (DWORD_PTR)1 << cpu ) )
+            {
+                if( pCPUs && numCPUs < maxCPUs )
+                {
+                    pCPUs[ numCPUs ] = cpu;
+                }
+                ++numCPUs;
+            }
+        }
+        return numCPUs;
+    }
+
+    // monotonic time in nanoseconds, for measuring intervals only
+    inline uint64_t GetTimeNS()
+    {
+        static LARGE_INTEGER frequency = { 0 };
+        if( 0 == frequency.QuadPart )
+        {
+            QueryPerformanceFrequency( &frequency );
+        }
+        LARGE_INTEGER counter;
+        QueryPerformanceCounter( &counter );
+        return (uint64_t)( (double)counter.QuadPart * ( 1.0e9 / (double)frequency.QuadPart ) );
+    }
+
+    // Cheap counter for timing short intervals on one thread, in ticks of a constant rate
+    // clock (the TSC on x86). Tick rate is platform dependent, calibrate against GetTimeNS.
+    inline uint64_t GetCycleCount()
     {
-        eventid_t ret;
-        ret.event = ::CreateEvent( NULL, TRUE, FALSE, NULL );
-        ret.countWaiters = 0;
-        return ret;
+    #if defined(_M_IX86) || defined(_M_X64)
+        return __rdtsc();
+    #else
+        LARGE_INTEGER counter;
+        QueryPerformanceCounter( &counter );
+        return (uint64_t)counter.QuadPart;
+    #endif
     }
 
-    inline void EventClose( eventid_t eventid )
+    // Returns the CPU the calling thread is currently running on, or -1 if unknown
+    inline int32_t GetCurrentCPU()
     {
-        CloseHandle( eventid.event );
+        return (int32_t)GetCurrentProcessorNumber();
     }
 
-    inline void EventWait( eventid_t& eventid, uint32_t milliseconds )
+    // Gives up the rest of the calling thread's timeslice to another ready thread
+    inline void ThreadYield()
     {
-        AtomicAdd( &eventid.countWaiters, 1 );
-        DWORD retval = WaitForSingleObject( eventid.event, milliseconds );
-        int32_t prev = AtomicAdd( &eventid.countWaiters, -1 );
-        if( 1 == prev )
+        SwitchToThread();
+    }
+
+    // Returns an id shared by CPUs with the same last level cache, currently Linux only
+    inline uint32_t GetCPUCacheGroup( uint32_t )
+    {
+        return 0;
+    }
+
+    // Returns an id shared by the SMT siblings of a physical core, which is the lowest
+    // numbered CPU of the core. Returns cpu if unknown. Slow - cache the results.
+    inline uint32_t GetCPUCore( uint32_t cpu )
+    {
+        uint32_t core = cpu;
+        DWORD length = 0;
+        GetLogicalProcessorInformation( NULL, &length );
+        uint32_t numInfos = length / sizeof( SYSTEM_LOGICAL_PROCESSOR_INFORMATION );
+        SYSTEM_LOGICAL_PROCESSOR_INFORMATION* pInfos = new SYSTEM_LOGICAL_PROCESSOR_INFORMATION[ numInfos ];
+        if( numInfos && GetLogicalProcessorInformation( pInfos, &length ) )
         {
-            // we were the last to awaken, so reset event.
-           ResetEvent( eventid.event );
+            for( uint32_t info = 0; info < numInfos; ++info )
+            {
+                ULONG_PTR mask = pInfos[ info ].ProcessorMask;
+                if( RelationProcessorCore == pInfos[ info ].Relationship &&
+                    cpu < sizeof( mask ) * 8 && ( mask & ( (ULONG_PTR)1 << cpu ) ) )
+                {
+                    core = 0;
+                    while( !( mask & ( (ULONG_PTR)1 << core ) ) )
+                    {
+                        ++core;
+                    }
+                    break;
+                }
+            }
         }
+        delete[] pInfos;
+        return core;
+    }
+
+    // Returns the NUMA node of the cpu, or 0 if unknown
+    inline uint32_t GetCPUNumaNode( uint32_t cpu )
+    {
+        UCHAR node = 0;
+        if( cpu > 0xFF || !GetNumaProcessorNode( (UCHAR)cpu, &node ) || 0xFF == node )
+        {
+            return 0;
+        }
+        return node;
+    }
+
+    // Counting semaphore, create in place as the address must not change whilst in use
+    struct semaphoreid_t
+    {
+        HANDLE      sem;
+    };
+
+    inline void SemaphoreCreate( semaphoreid_t& semaphoreid )
+    {
+        semaphoreid.sem = CreateSemaphore( NULL, 0, MAXLONG, NULL );
+    }
+
+    inline void SemaphoreClose( semaphoreid_t& semaphoreid )
+    {
+        CloseHandle( semaphoreid.sem );
+    }
+
+    inline void SemaphoreWait( semaphoreid_t& semaphoreid )
+    {
+        DWORD retval = WaitForSingleObject( semaphoreid.sem, INFINITE );
         assert( retval != WAIT_FAILED );
-        assert( prev != 0 );
     }
 
-    inline void EventSignal( eventid_t eventid )
+    // Returns true if signalled, false if timeoutNS passed first
+    inline bool SemaphoreWaitTimeout( semaphoreid_t& semaphoreid, uint64_t timeoutNS )
     {
-        SetEvent( eventid.event );
+        // round up so we do not wake before the timeout
+        uint64_t milliseconds = ( timeoutNS + 999999 ) / 1000000;
+        DWORD retval = WaitForSingleObject( semaphoreid.sem, milliseconds < INFINITE ? (DWORD)milliseconds : INFINITE - 1 );
+        assert( retval != WAIT_FAILED );
+        return WAIT_OBJECT_0 == retval;
+    }
+
+    inline void SemaphoreSignal( semaphoreid_t& semaphoreid, int32_t countWaiting )
+    {
+        if( countWaiting )
+        {
+            ReleaseSemaphore( semaphoreid.sem, countWaiting, NULL );
+        }
     }
 }
 
@@ -101,24 +269,63 @@ namespace enki
 
 	#include <pthread.h>
 	#include <unistd.h>
+	#include <time.h>
+	#include <stdio.h>
+	#include <sched.h>
+	#ifdef __linux__
+		#include <dirent.h>
+		#include <string.h>
+	#endif
+	#if defined(__i386__) || defined(__x86_64__)
+		#include <x86intrin.h>
+	#endif
+	#ifdef __APPLE__
+		#include <mach/mach_time.h>
+	#endif
+	#ifdef __linux__
+		#include <linux/futex.h>
+		#include <sys/syscall.h>
+	#endif
 	#define THREADFUNC_DECL void*
 	#define THREAD_LOCAL __thread
 
 namespace enki
 {
     typedef pthread_t threadid_t;
-    struct eventid_t
-    {
-        pthread_cond_t  cond;
-        pthread_mutex_t mutex;
-    };
-    const uint32_t EVENTWAIT_INFINITE = -1;
     
         
     // declare the thread start function as:
     // THREADFUNC_DECL MyThreadStart( void* pArg );
-    inline bool ThreadCreate( threadid_t* returnid, void* ( *StartFunc) (void* ), void* pArg )
+    // cpu >= 0 pins the thread to that cpu before it starts, if possible (Linux only).
+    // pbPinned, if not NULL, is set to whether the thread was pinned.
+    inline bool ThreadCreate( threadid_t* returnid, void* ( *StartFunc) (void* ), void* pArg, int32_t cpu = -1, bool* pbPinned = NULL )
     {
+        if( pbPinned )
+        {
+            *pbPinned = false;
+        }
+    #ifdef __linux__
+        if( cpu >= 0 && cpu < CPU_SETSIZE )
+        {
+            cpu_set_t cpuSet;
+            CPU_ZERO( &cpuSet );
+            CPU_SET( cpu, &cpuSet );
+            pthread_attr_t attr;
+            pthread_attr_init( &attr );
+            pthread_attr_setaffinity_np( &attr, sizeof( cpuSet ), &cpuSet );
+            int32_t retval = pthread_create( returnid, &attr, StartFunc, pArg );
+            pthread_attr_destroy( &attr );
+            if( retval == 0 )
+            {
+                if( pbPinned )
+                {
+                    *pbPinned = true;
+                }
+                return true;
+            }
+            // the cpu may not be in our affinity mask, so fall back to not pinning
+        }
+    #endif
         // posix equiv pthread_create
         int32_t retval = pthread_create( returnid, NULL, StartFunc, pArg );
 
@@ -135,43 +342,508 @@ namespace enki
     {
         return (uint32_t)sysconf( _SC_NPROCESSORS_ONLN );
     }
-    
-    inline eventid_t EventCreate()
+
+#ifdef __linux__
+    static const size_t CGROUP_PATH_MAX = 512;
+
+    // Opens the file in the cgroup directory for reading, or returns NULL if the path is too long.
+    // The path has room for a directory of up to CGROUP_PATH_MAX and the longest file name.
+    inline FILE* OpenCgroupFile( const char* dir, const char* name )
     {
-        eventid_t event = { PTHREAD_COND_INITIALIZER, PTHREAD_MUTEX_INITIALIZER };
-        return event;
+        char path[ CGROUP_PATH_MAX + 32 ];
+        int length = snprintf( path, sizeof(path), "%s/%s", dir, name );
+        if( length < 0 || length >= (int)sizeof(path) )
+        {
+            return NULL;
+        }
+        return fopen( path, "r" );
     }
-    
-    inline void EventClose( eventid_t eventid )
+
+    // Returns the CPU quota of the cgroup directory in thousandths of a CPU, or 0 if unlimited or unknown
+    inline uint32_t ReadCgroupCPUQuotaMilli( const char* dir, bool bVersion2 )
+    {
+        long long quota  = -1;
+        long long period = 0;
+        if( bVersion2 )
+        {
+            // cpu.max is of the form "max 100000" if unlimited or "800000 100000"
+            FILE* pFile = OpenCgroupFile( dir, "cpu.max" );
+            if( pFile )
+            {
+                if( 2 != fscanf( pFile, "%lld %lld", &quota, &period ) )
+                {
+                    quota = -1;
+                }
+                fclose( pFile );
+            }
+        }
+        else
+        {
+            // cpu.cfs_quota_us is -1 if unlimited
+            FILE* pFile = OpenCgroupFile( dir, "cpu.cfs_quota_us" );
+            if( pFile )
+            {
+                if( 1 != fscanf( pFile, "%lld", &quota ) )
+                {
+                    quota = -1;
+                }
+                fclose( pFile );
+            }
+            pFile = OpenCgroupFile( dir, "cpu.cfs_period_us" );
+            if( pFile )
+            {
+                if( 1 != fscanf( pFile, "%lld", &period ) )
+                {
+                    period = 0;
+                }
+                fclose( pFile );
+            }
+        }
+        if( quota <= 0 || period <= 0 )
+        {
+            return 0;
+        }
+        long long quotaMilli = quota * 1000 / period;
+        return quotaMilli > 0 ? (uint32_t)quotaMilli : 1;
+    }
+
+    // Returns the lowest CPU quota of the cgroup at cgroupPath under mount and of its parents, as
+    // a parent's limit applies to its children. Inside a container without a cgroup namespace the
+    // path may be the host's, which does not exist under the container's mount, so the mount root
+    // is read as well.
+    inline uint32_t GetCgroupCPUQuotaMilli( const char* mount, const char* cgroupPath, bool bVersion2 )
+    {
+        char dir[ CGROUP_PATH_MAX ];
+        int length = snprintf( dir, sizeof(dir), "%s%s", mount, cgroupPath );
+        if( length < 0 || length >= (int)sizeof(dir) )
+        {
+            // unknown rather than reading a cut off path
+            return 0;
+        }
+        size_t mountLength = strlen( mount );
+        uint32_t quotaMilli = 0;
+        while( true )
+        {
+            uint32_t dirQuotaMilli = ReadCgroupCPUQuotaMilli( dir, bVersion2 );
+            if( dirQuotaMilli && ( 0 == quotaMilli || dirQuotaMilli < quotaMilli ) )
+            {
+                quotaMilli = dirQuotaMilli;
+            }
+            char* pSlash = strrchr( dir + mountLength, '/' );
+            if( !pSlash )
+            {
+                break;
+            }
+            *pSlash = 0;
+        }
+        return quotaMilli;
+    }
+#endif
+
+    // Returns the CPUs the process can use, reading the affinity mask and on Linux the CPU
+    // quota of the process's cgroups (v2 cpu.max or v1 cpu.cfs_quota_us), so that containers
+    // with a quota lower than the machine's CPU count are not oversubscribed.
+    // Reads /proc and /sys/fs/cgroup so is slow - cache the results.
+    inline CPUResources GetCPUResources()
     {
-        // do not need to close event
+        CPUResources resources;
+        resources.numOnlineCPUs   = GetNumHardwareThreads();
+        resources.numAffinityCPUs = resources.numOnlineCPUs;
+        resources.cpuQuotaMilli   = 0;
+    #ifdef __linux__
+        cpu_set_t cpuSet;
+        CPU_ZERO( &cpuSet );
+        if( 0 == sched_getaffinity( 0, sizeof( cpuSet ), &cpuSet ) && CPU_COUNT( &cpuSet ) > 0 )
+        {
+            resources.numAffinityCPUs = (uint32_t)CPU_COUNT( &cpuSet );
+        }
+
+        // lines are of the form "0::/path" for cgroup v2 and "3:cpu,cpuacct:/path" for v1
+        FILE* pFile = fopen( "/proc/self/cgroup", "r" );
+        if( pFile )
+        {
+            char line[512];
+            while( fgets( line, sizeof(line), pFile ) )
+            {
+                char* pControllers = strchr( line, ':' );
+                char* pPath = pControllers ? strchr( pControllers + 1, ':' ) : NULL;
+                if( !pPath )
+                {
+                    continue;
+                }
+                *pControllers++ = 0;
+                *pPath++ = 0;
+                pPath[ strcspn( pPath, "\n" ) ] = 0;
+
+                uint32_t quotaMilli = 0;
+                if( 0 == *pControllers )
+                {
+                    quotaMilli = GetCgroupCPUQuotaMilli( "/sys/fs/cgroup", pPath, true );
+                }
+                else
+                {
+                    char* pSave = NULL;
+                    for( char* pController = strtok_r( pControllers, ",", &pSave ); pController;
+                         pController = strtok_r( NULL, ",", &pSave ) )
+                    {
+                        if( 0 == strcmp( pController, "cpu" ) )
+                        {
+                            // usually mounted as cpu,cpuacct with a cpu symlink
+                            quotaMilli = GetCgroupCPUQuotaMilli( "/sys/fs/cgroup/cpu", pPath, false );
+                            break;
+                        }
+                    }
+                }
+                if( quotaMilli && ( 0 == resources.cpuQuotaMilli || quotaMilli < resources.cpuQuotaMilli ) )
+                {
+                    resources.cpuQuotaMilli = quotaMilli;
+                }
+            }
+            fclose( pFile );
+        }
+    #endif
+        resources.numUsableCPUs = resources.numAffinityCPUs;
+        if( resources.cpuQuotaMilli )
+        {
+            uint32_t numQuotaCPUs = ( resources.cpuQuotaMilli + 999 ) / 1000;
+            if( numQuotaCPUs < resources.numUsableCPUs )
+            {
+                resources.numUsableCPUs = numQuotaCPUs;
+            }
+        }
+        if( 0 == resources.numUsableCPUs )
+        {
+            resources.numUsableCPUs = 1;
+        }
+        return resources;
+    }
+
+    // Writes up to maxCPUs of the CPUs in the process affinity mask to pCPUs in ascending order,
+    // and returns how many there are. Pass pCPUs NULL to count them. Other than on Linux all
+    // online CPUs are returned.
+    inline uint32_t GetAffinityCPUs( uint32_t* pCPUs, uint32_t maxCPUs )
+    {
+        uint32_t numCPUs = 0;
+    #ifdef __linux__
+        cpu_set_t cpuSet;
+        CPU_ZERO( &cpuSet );
+        if( 0 == sched_getaffinity( 0, sizeof( cpuSet ), &cpuSet ) && CPU_COUNT( &cpuSet ) > 0 )
+        {
+            for( uint32_t cpu = 0; cpu < CPU_SETSIZE; ++cpu )
+            {
+                if( CPU_ISSET( cpu, &cpuSet ) )
+                {
+                    if( pCPUs && numCPUs < maxCPUs )
+                    {
+                        pCPUs[ numCPUs ] = cpu;
+                    }
+                    ++numCPUs;
+                }
+            }
+            return numCPUs;
+        }
+    #endif
+        numCPUs = GetNumHardwareThreads();
+        for( uint32_t cpu = 0; pCPUs && cpu < numCPUs && cpu < maxCPUs; ++cpu )
+        {
+            pCPUs[ cpu ] = cpu;
+        }
+        return numCPUs;
+    }
+
+    // monotonic time in nanoseconds, for measuring intervals only
+    inline uint64_t GetTimeNS()
+    {
+    #ifdef __APPLE__
+        static mach_timebase_info_data_t timebase = { 0, 0 };
+        if( 0 == timebase.denom )
+        {
+            mach_timebase_info( &timebase );
+        }
+        return mach_absolute_time() * timebase.numer / timebase.denom;
+    #else
+        timespec ts;
+        clock_gettime( CLOCK_MONOTONIC, &ts );
+        return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+    #endif
+    }
+
+    // Cheap counter for timing short intervals on one thread, in ticks of a constant rate
+    // clock (the TSC on x86). Tick rate is platform dependent, calibrate against GetTimeNS.
+    inline uint64_t GetCycleCount()
+    {
+    #if defined(__i386__) || defined(__x86_64__)
+        return __rdtsc();
+    #elif defined(__aarch64__)
+        uint64_t count;
+        __asm__ __volatile__("mrs %0, cntvct_el0" : "=r"(count));
+        return count;
+    #else
+        return GetTimeNS();
+    #endif
+    }
+
+    // Returns the CPU the calling thread is currently running on, or -1 if unknown
+    inline int32_t GetCurrentCPU()
+    {
+    #ifdef __linux__
+        return sched_getcpu();
+    #else
+        return -1;
+    #endif
+    }
+
+    // Gives up the rest of the calling thread's timeslice to another ready thread
+    inline void ThreadYield()
+    {
+        sched_yield();
+    }
+
+    // Returns an id shared by CPUs with the same last level cache (L3, or CCX on AMD),
+    // which is the lowest numbered CPU sharing it. Returns 0 if unknown.
+    // Reads /sys/devices/system/cpu so is slow - cache the results.
+    inline uint32_t GetCPUCacheGroup( uint32_t cpu )
+    {
+        uint32_t group    = 0;
+    #ifdef __linux__
+        uint32_t maxLevel = 0;
+        for( uint32_t index = 0; index < 16; ++index )
+        {
+            char path[128];
+            snprintf( path, sizeof(path), "/sys/devices/system/cpu/cpu%u/cache/index%u/level", cpu, index );
+            FILE* pFile = fopen( path, "r" );
+            if( !pFile )
+            {
+                break;
+            }
+            uint32_t level = 0;
+            int numRead = fscanf( pFile, "%u", &level );
+            fclose( pFile );
+            if( 1 != numRead || level <= maxLevel )
+            {
+                continue;
+            }
+
+            // shared_cpu_list is of the form 0-7,64-71 so the first number is the lowest cpu
+            snprintf( path, sizeof(path), "/sys/devices/system/cpu/cpu%u/cache/index%u/shared_cpu_list", cpu, index );
+            pFile = fopen( path, "r" );
+            if( pFile )
+            {
+                uint32_t firstCPU = 0;
+                if( 1 == fscanf( pFile, "%u", &firstCPU ) )
+                {
+                    maxLevel = level;
+                    group    = firstCPU;
+                }
+                fclose( pFile );
+            }
+        }
+    #endif
+        return group;
+    }
+
+    // Returns an id shared by the SMT siblings of a physical core, which is the lowest
+    // numbered CPU of the core. Returns cpu if unknown. Slow - cache the results.
+    inline uint32_t GetCPUCore( uint32_t cpu )
+    {
+        uint32_t core = cpu;
+    #ifdef __linux__
+        // thread_siblings_list is of the form 0,64 or 0-1 so the first number is the lowest cpu
+        char path[128];
+        snprintf( path, sizeof(path), "/sys/devices/system/cpu/cpu%u/topology/thread_siblings_list", cpu );
+        FILE* pFile = fopen( path, "r" );
+        if( pFile )
+        {
+            uint32_t firstCPU = 0;
+            if( 1 == fscanf( pFile, "%u", &firstCPU ) )
+            {
+                core = firstCPU;
+            }
+            fclose( pFile );
+        }
+    #endif
+        return core;
+    }
+
+    // Returns the NUMA node of the cpu, or 0 if unknown. Slow - cache the results.
+    inline uint32_t GetCPUNumaNode( uint32_t cpu )
+    {
+        uint32_t node = 0;
+    #ifdef __linux__
+        // the cpu's directory has a link named node<N> to its node
+        char path[128];
+        snprintf( path, sizeof(path), "/sys/devices/system/cpu/cpu%u", cpu );
+        DIR* pDir = opendir( path );
+        if( pDir )
+        {
+            while( dirent* pEntry = readdir( pDir ) )
+            {
+                if( 1 == sscanf( pEntry->d_name, "node%u", &node ) )
+                {
+                    break;
+                }
+            }
+            closedir( pDir );
+        }
+    #endif
+        return node;
     }
     
-    inline void EventWait( eventid_t& eventid, uint32_t milliseconds )
+#ifdef __linux__
+    // Counting semaphore using a futex, create in place as the address must not change whilst in use.
+    // Signalling only makes a syscall if there are waiters.
+    struct semaphoreid_t
+    {
+        volatile int32_t    count;
+        volatile int32_t    numWaiters;
+    };
+
+    inline void SemaphoreCreate( semaphoreid_t& semaphoreid )
+    {
+        semaphoreid.count      = 0;
+        semaphoreid.numWaiters = 0;
+    }
+
+    inline void SemaphoreClose( semaphoreid_t& )
+    {
+        // do not need to close futex
+    }
+
+    inline void SemaphoreWait( semaphoreid_t& semaphoreid )
     {
-        pthread_mutex_lock( &eventid.mutex );
-        if( milliseconds == EVENTWAIT_INFINITE )
+        while( true )
         {
-            pthread_cond_wait( &eventid.cond, &eventid.mutex );
+            int32_t count = AtomicLoad( &semaphoreid.count, MEMORY_ORDER_RELAXED );
+            if( count > 0 )
+            {
+                if( count == (int32_t)AtomicCompareAndSwap( (volatile uint32_t*)&semaphoreid.count, count - 1, count ) )
+                {
+                    return;
+                }
+                continue;
+            }
+            // futex only sleeps if count is still 0, so a signal after our check is not lost
+            AtomicAdd( &semaphoreid.numWaiters, 1 );
+            syscall( SYS_futex, &semaphoreid.count, FUTEX_WAIT_PRIVATE, 0, NULL, NULL, 0 );
+            AtomicAdd( &semaphoreid.numWaiters, -1 );
         }
-        else
+    }
+
+    // Returns true if signalled, false if timeoutNS passed first
+    inline bool SemaphoreWaitTimeout( semaphoreid_t& semaphoreid, uint64_t timeoutNS )
+    {
+        uint64_t endNS = GetTimeNS() + timeoutNS;
+        while( true )
         {
+            int32_t count = AtomicLoad( &semaphoreid.count, MEMORY_ORDER_RELAXED );
+            if( count > 0 )
+            {
+                if( count == (int32_t)AtomicCompareAndSwap( (volatile uint32_t*)&semaphoreid.count, count - 1, count ) )
+                {
+                    return true;
+                }
+                continue;
+            }
+            uint64_t nowNS = GetTimeNS();
+            if( nowNS >= endNS )
+            {
+                return false;
+            }
+            // futex timeout is relative
             timespec waittime;
-            waittime.tv_sec = milliseconds/1000;
-            milliseconds -= waittime.tv_sec*1000;
-            waittime.tv_nsec = milliseconds * 1000;
-            pthread_cond_timedwait( &eventid.cond, &eventid.mutex, &waittime );
+            waittime.tv_sec  = (time_t)( ( endNS - nowNS ) / 1000000000 );
+            waittime.tv_nsec = (long)( ( endNS - nowNS ) % 1000000000 );
+            AtomicAdd( &semaphoreid.numWaiters, 1 );
+            syscall( SYS_futex, &semaphoreid.count, FUTEX_WAIT_PRIVATE, 0, &waittime, NULL, 0 );
+            AtomicAdd( &semaphoreid.numWaiters, -1 );
+        }
+    }
 
+    inline void SemaphoreSignal( semaphoreid_t& semaphoreid, int32_t countWaiting )
+    {
+        // full barrier: either we see a waiter, or its futex wait sees the count
+        AtomicAdd( &semaphoreid.count, countWaiting );
+        if( AtomicLoad( &semaphoreid.numWaiters ) )
+        {
+            syscall( SYS_futex, &semaphoreid.count, FUTEX_WAKE_PRIVATE, countWaiting, NULL, NULL, 0 );
         }
-        pthread_mutex_unlock( &eventid.mutex );
     }
-    
-    inline void EventSignal( eventid_t& eventid )
+#else
+    // Counting semaphore, create in place as the address must not change whilst in use
+    struct semaphoreid_t
+    {
+        pthread_cond_t      cond;
+        pthread_mutex_t     mutex;
+        int32_t             count;
+    };
+
+    inline void SemaphoreCreate( semaphoreid_t& semaphoreid )
+    {
+        pthread_cond_init( &semaphoreid.cond, NULL );
+        pthread_mutex_init( &semaphoreid.mutex, NULL );
+        semaphoreid.count = 0;
+    }
+
+    inline void SemaphoreClose( semaphoreid_t& semaphoreid )
+    {
+        pthread_cond_destroy( &semaphoreid.cond );
+        pthread_mutex_destroy( &semaphoreid.mutex );
+    }
+
+    inline void SemaphoreWait( semaphoreid_t& semaphoreid )
+    {
+        pthread_mutex_lock( &semaphoreid.mutex );
+        while( semaphoreid.count <= 0 )
+        {
+            pthread_cond_wait( &semaphoreid.cond, &semaphoreid.mutex );
+        }
+        --semaphoreid.count;
+        pthread_mutex_unlock( &semaphoreid.mutex );
+    }
+
+    // Returns true if signalled, false if timeoutNS passed first
+    inline bool SemaphoreWaitTimeout( semaphoreid_t& semaphoreid, uint64_t timeoutNS )
     {
-        pthread_mutex_lock( &eventid.mutex );
-        pthread_cond_broadcast( &eventid.cond );
-        pthread_mutex_unlock( &eventid.mutex );
+        // pthread_cond_timedwait takes an absolute CLOCK_REALTIME time
+        timespec waittime;
+        clock_gettime( CLOCK_REALTIME, &waittime );
+        uint64_t nsec = (uint64_t)waittime.tv_nsec + timeoutNS;
+        waittime.tv_sec += (time_t)( nsec / 1000000000 );
+        waittime.tv_nsec = (long)( nsec % 1000000000 );
+
+        pthread_mutex_lock( &semaphoreid.mutex );
+        bool bSignalled = true;
+        while( semaphoreid.count <= 0 )
+        {
+            if( 0 != pthread_cond_timedwait( &semaphoreid.cond, &semaphoreid.mutex, &waittime ) && semaphoreid.count <= 0 )
+            {
+                bSignalled = false;
+                break;
+            }
+        }
+        if( bSignalled )
+        {
+            --semaphoreid.count;
+        }
+        pthread_mutex_unlock( &semaphoreid.mutex );
+        return bSignalled;
+    }
+
+    inline void SemaphoreSignal( semaphoreid_t& semaphoreid, int32_t countWaiting )
+    {
+        pthread_mutex_lock( &semaphoreid.mutex );
+        semaphoreid.count += countWaiting;
+        pthread_mutex_unlock( &semaphoreid.mutex );
+        if( 1 == countWaiting )
+        {
+            pthread_cond_signal( &semaphoreid.cond );
+        }
+        else
+        {
+            pthread_cond_broadcast( &semaphoreid.cond );
+        }
     }
+#endif
 }
 
 #endif // posix